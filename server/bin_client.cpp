@@ -0,0 +1,106 @@
+#include <cstring>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "err/err.h"
+#include "opt/opt.h"
+#include "bin_client.h"
+
+BinClient::BinClient(const std::string & host, const int port): next_id(0){
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  auto port_s = type_to_str(port);
+  int e = getaddrinfo(host.c_str(), port_s.c_str(), &hints, &res);
+  if (e) throw Err() << "can't get address of " << host << ": " << gai_strerror(e);
+
+  fd = -1;
+  int err = 0;
+  for (auto p = res; p!=NULL; p = p->ai_next){
+    fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+    if (fd<0) {err = errno; continue;}
+    if (connect(fd, p->ai_addr, p->ai_addrlen) == 0) break;
+    err = errno;
+    ::close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if (fd<0) throw Err() << "can't connect to " << host << ":" << port
+                        << ": " << strerror(err);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+BinClient::BinClient(const std::string & path): next_id(0){
+  struct sockaddr_un sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(sa.sun_path))
+    throw Err() << "too long socket path: " << path;
+  strncpy(sa.sun_path, path.c_str(), sizeof(sa.sun_path)-1);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd<0) throw Err() << "can't create socket: " << strerror(errno);
+  if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0){
+    auto e = errno;
+    ::close(fd);
+    throw Err() << "can't connect to " << path << ": " << strerror(e);
+  }
+}
+
+BinClient::~BinClient(){
+  ::close(fd);
+}
+
+uint32_t
+BinClient::send(const std::string & act, const std::string & arg,
+                const std::string & msg, const Opt & opts){
+  BinRequest req;
+  req.id  = next_id++;
+  req.act = act;
+  req.arg = arg;
+  req.msg = msg;
+  req.opts = opts;
+  bin_write(fd, bin_pack(req));
+  return req.id;
+}
+
+BinResponse
+BinClient::recv(){
+  if (early.size()){
+    auto r = early.begin()->second;
+    early.erase(early.begin());
+    return r;
+  }
+  std::string body;
+  if (!bin_read_frame(fd, body))
+    throw Err() << "binary protocol: connection closed by the server";
+  return bin_unpack_response(body);
+}
+
+std::string
+BinClient::get(const std::string & act, const std::string & arg,
+               const std::string & msg, const Opt & opts){
+  auto id = send(act, arg, msg, opts);
+  while (1){
+    BinResponse r;
+    if (early.count(id)) {
+      r = early[id];
+      early.erase(id);
+    }
+    else {
+      std::string body;
+      if (!bin_read_frame(fd, body))
+        throw Err() << "binary protocol: connection closed by the server";
+      r = bin_unpack_response(body);
+      if (r.id != id) {early[r.id] = r; continue;}
+    }
+    if (r.err) throw Err() << r.data;
+    return r.data;
+  }
+}
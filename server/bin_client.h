@@ -0,0 +1,47 @@
+#ifndef BIN_CLIENT_H
+#define BIN_CLIENT_H
+
+#include <string>
+#include <map>
+#include "bin_proto.h"
+
+/*************************************************/
+// Client for the binary protocol (see bin_proto.h).
+// Requests can be sent without waiting for answers (send/recv),
+// or one by one (get).
+
+class BinClient {
+  int fd;
+  uint32_t next_id;
+  std::map<uint32_t, BinResponse> early; // responses received by get()
+
+public:
+  // Connect to a TCP port.
+  BinClient(const std::string & host, const int port);
+
+  // Connect to a unix domain socket.
+  BinClient(const std::string & path);
+
+  ~BinClient();
+
+  // Socket (can be polled before recv()).
+  int get_fd() const {return fd;}
+
+  // Send a request, return its ID.
+  uint32_t send(const std::string & act,
+                const std::string & arg = "",
+                const std::string & msg = "",
+                const Opt & opts = Opt());
+
+  // Receive next response (in any order).
+  BinResponse recv();
+
+  // Send a request and wait for its response.
+  // Throw Err with the error message if the server returns an error.
+  std::string get(const std::string & act,
+                  const std::string & arg = "",
+                  const std::string & msg = "",
+                  const Opt & opts = Opt());
+};
+
+#endif
@@ -0,0 +1,171 @@
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "err/err.h"
+#include "bin_proto.h"
+
+/*************************************************/
+// integer packing
+
+static void
+put_u32(std::string & s, uint32_t v){
+  char b[4] = {char(v>>24), char(v>>16), char(v>>8), char(v)};
+  s.append(b, 4);
+}
+
+static void
+put_u16(std::string & s, uint16_t v){
+  char b[2] = {char(v>>8), char(v)};
+  s.append(b, 2);
+}
+
+static void
+put_str(std::string & s, const std::string & v){
+  put_u32(s, v.size());
+  s.append(v);
+}
+
+static uint32_t
+get_u32(const char * p){
+  auto u = (const unsigned char *)p;
+  return (uint32_t(u[0])<<24) | (uint32_t(u[1])<<16) |
+         (uint32_t(u[2])<<8)  |  uint32_t(u[3]);
+}
+
+// reading fields from a frame body
+struct BinReader {
+  const std::string & s;
+  size_t pos;
+  BinReader(const std::string & s): s(s), pos(0) {}
+
+  void check(size_t n){
+    if (s.size() - pos < n) throw Err() << "binary protocol: short frame";
+  }
+  uint32_t u32(){
+    check(4); pos+=4;
+    return get_u32(s.data()+pos-4);
+  }
+  uint16_t u16(){
+    check(2); pos+=2;
+    auto u = (const unsigned char *)s.data()+pos-2;
+    return (uint16_t(u[0])<<8) | u[1];
+  }
+  uint8_t u8(){
+    check(1);
+    return (uint8_t)s[pos++];
+  }
+  std::string str(){
+    uint32_t n = u32();
+    check(n); pos+=n;
+    return s.substr(pos-n, n);
+  }
+};
+
+/*************************************************/
+
+std::string
+bin_pack(const BinRequest & req){
+  std::string ret;
+  size_t size = 4+2+12 + req.act.size() + req.arg.size() + req.msg.size();
+  for (auto const & o:req.opts) size += 8 + o.first.size() + o.second.size();
+  if (size > BIN_MAX_FRAME) throw Err() << "binary protocol: too long request";
+  ret.reserve(size+4);
+
+  put_u32(ret, size);
+  put_u32(ret, req.id);
+  put_u16(ret, 3 + 2*req.opts.size());
+  put_str(ret, req.act);
+  put_str(ret, req.arg);
+  put_str(ret, req.msg);
+  for (auto const & o:req.opts){
+    put_str(ret, o.first);
+    put_str(ret, o.second);
+  }
+  return ret;
+}
+
+std::string
+bin_pack(const BinResponse & resp){
+  std::string ret;
+  size_t size = 4+1 + resp.data.size();
+  if (size > BIN_MAX_FRAME) throw Err() << "binary protocol: too long response";
+  ret.reserve(size+4);
+  put_u32(ret, size);
+  put_u32(ret, resp.id);
+  ret.push_back(resp.err? 1:0);
+  ret.append(resp.data);
+  return ret;
+}
+
+BinRequest
+bin_unpack_request(const std::string & body){
+  BinReader r(body);
+  BinRequest ret;
+  ret.id = r.u32();
+  uint16_t n = r.u16();
+  if (n<3 || n%2 == 0) throw Err()
+    << "binary protocol: wrong number of fields in a request: " << n;
+  ret.act = r.str();
+  ret.arg = r.str();
+  ret.msg = r.str();
+  for (int i=3; i<n; i+=2){
+    auto k = r.str();
+    ret.opts.put(k, r.str());
+  }
+  if (r.pos != body.size()) throw Err() << "binary protocol: extra data in a request";
+  return ret;
+}
+
+BinResponse
+bin_unpack_response(const std::string & body){
+  BinReader r(body);
+  BinResponse ret;
+  ret.id = r.u32();
+  auto st = r.u8();
+  if (st>1) throw Err() << "binary protocol: unknown status: " << (int)st;
+  ret.err = st;
+  ret.data = body.substr(r.pos);
+  return ret;
+}
+
+/*************************************************/
+
+// read exactly n bytes, return number of bytes read before EOF
+static size_t
+read_all(int fd, char * buf, size_t n){
+  size_t p = 0;
+  while (p<n){
+    auto res = ::recv(fd, buf+p, n-p, 0);
+    if (res<0 && errno==EINTR) continue;
+    if (res<0) throw Err() << "binary protocol: read error: " << strerror(errno);
+    if (res==0) break;
+    p+=res;
+  }
+  return p;
+}
+
+bool
+bin_read_frame(int fd, std::string & body){
+  char b[4];
+  auto n = read_all(fd, b, 4);
+  if (n==0) return false;
+  if (n<4) throw Err() << "binary protocol: connection closed";
+  uint32_t size = get_u32(b);
+  if (size > BIN_MAX_FRAME) throw Err() << "binary protocol: too long frame: " << size;
+  body.resize(size);
+  if (size && read_all(fd, &body[0], size) < size)
+    throw Err() << "binary protocol: connection closed";
+  return true;
+}
+
+void
+bin_write(int fd, const std::string & data){
+  size_t p = 0;
+  while (p<data.size()){
+    auto res = ::send(fd, data.data()+p, data.size()-p, MSG_NOSIGNAL);
+    if (res<0 && errno==EINTR) continue;
+    if (res<0) throw Err() << "binary protocol: write error: " << strerror(errno);
+    p+=res;
+  }
+}
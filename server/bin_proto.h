@@ -0,0 +1,70 @@
+#ifndef BIN_PROTO_H
+#define BIN_PROTO_H
+
+#include <string>
+#include <cstdint>
+#include "opt/opt.h"
+
+/*************************************************/
+// Binary protocol for device_d: a compact alternative to HTTP for
+// high-rate requests (see bin_server.h, device_c --bin option).
+//
+// Each frame is a 4-byte length followed by the frame body of this length.
+// All integers are unsigned, big-endian.
+//
+// Request body:
+//   u32 id     -- request ID, returned in the response
+//   u16 n      -- number of strings (at least 3, odd)
+//   n * (u32 len, bytes) -- action, argument (device), message,
+//                           then option name/value pairs.
+//
+// Response body:
+//   u32 id     -- request ID
+//   u8  status -- 0: success, 1: error
+//   bytes      -- answer or error message (rest of the frame)
+//
+// Requests on one connection are processed in parallel, responses are
+// sent as soon as they are ready; use IDs to match them.
+//
+// Over WebSocket (see HTTP_Server) frame bodies are sent as binary
+// messages without the length prefix. The server also pushes messages
+// with ID BIN_PUSH_ID, their data is "updates\n<update lines>" (see
+// updates action) or "log <device>\n<log lines>" (see log_start action).
+
+// Maximum frame size
+#define BIN_MAX_FRAME (64*1024*1024)
+
+// Request ID of messages pushed by the server (should not be
+// used by clients)
+#define BIN_PUSH_ID 0xFFFFFFFF
+
+struct BinRequest {
+  uint32_t id;
+  std::string act, arg, msg;
+  Opt opts;
+  BinRequest(): id(0) {}
+};
+
+struct BinResponse {
+  uint32_t id;
+  bool err;
+  std::string data;
+  BinResponse(): id(0), err(false) {}
+};
+
+// Pack a request/response into a frame (including length prefix).
+std::string bin_pack(const BinRequest & req);
+std::string bin_pack(const BinResponse & resp);
+
+// Unpack frame body (without length prefix).
+BinRequest  bin_unpack_request(const std::string & body);
+BinResponse bin_unpack_response(const std::string & body);
+
+// Read one frame body from a socket. Return false on end of file
+// before the frame starts, throw Err on errors.
+bool bin_read_frame(int fd, std::string & body);
+
+// Write data to a socket.
+void bin_write(int fd, const std::string & data);
+
+#endif
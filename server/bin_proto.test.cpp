@@ -0,0 +1,91 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include "bin_proto.h"
+#include "err/assert_err.h"
+
+using namespace std;
+
+int
+main(){
+  try{
+
+    // request
+    {
+      BinRequest r;
+      r.id = 0x01020304;
+      r.act = "ask";
+      r.arg = "dev";
+      r.msg = string("a\0b\n", 4);
+      r.opts.put("deadline", "0.5");
+      auto f = bin_pack(r);
+      assert_eq(f.size(), 4+4+2+12+3+3+4 + 8+8+3);
+      assert_eq(f.substr(0,8), string("\0\0\0\x2f\x01\x02\x03\x04", 8));
+
+      auto r1 = bin_unpack_request(f.substr(4));
+      assert_eq(r1.id, r.id);
+      assert_eq(r1.act, "ask");
+      assert_eq(r1.arg, "dev");
+      assert_eq(r1.msg, r.msg);
+      assert_eq(r1.opts.get("deadline"), "0.5");
+      assert_eq(r1.opts.size(), 1);
+
+      assert_err(bin_unpack_request(f.substr(4, f.size()-5)),
+        "binary protocol: short frame");
+      assert_err(bin_unpack_request(f.substr(4) + "x"),
+        "binary protocol: extra data in a request");
+      assert_err(bin_unpack_request(string("\0\0\0\0\0\2", 6)),
+        "binary protocol: wrong number of fields in a request: 2");
+    }
+
+    // response
+    {
+      BinResponse r;
+      r.id = 5;
+      r.err = true;
+      r.data = "error";
+      auto f = bin_pack(r);
+      assert_eq(f, string("\0\0\0\x0a\0\0\0\5\1error", 14));
+      auto r1 = bin_unpack_response(f.substr(4));
+      assert_eq(r1.id, 5);
+      assert_eq(r1.err, true);
+      assert_eq(r1.data, "error");
+
+      r.err = false;
+      r.data = "";
+      r1 = bin_unpack_response(bin_pack(r).substr(4));
+      assert_eq(r1.err, false);
+      assert_eq(r1.data, "");
+      assert_err(bin_unpack_response(string("\0\0\0\0\2", 5)),
+        "binary protocol: unknown status: 2");
+    }
+
+    // reading/writing frames
+    {
+      int sv[2];
+      assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+      BinResponse r;
+      r.id = 1; r.data = "abc";
+      bin_write(sv[0], bin_pack(r) + bin_pack(r));
+      bin_write(sv[0], string("\0\0\0\5ab", 6));
+      shutdown(sv[0], SHUT_WR);
+      string body;
+      assert_eq(bin_read_frame(sv[1], body), true);
+      assert_eq(bin_unpack_response(body).data, "abc");
+      assert_eq(bin_read_frame(sv[1], body), true);
+      assert_err(bin_read_frame(sv[1], body),
+        "binary protocol: connection closed");
+      assert_eq(bin_read_frame(sv[1], body), false);
+      close(sv[0]); close(sv[1]);
+    }
+
+  }
+  catch (Err e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
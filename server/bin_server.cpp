@@ -0,0 +1,357 @@
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "err/err.h"
+#include "log/log.h"
+#include "bin_proto.h"
+#include "bin_server.h"
+#include "websocket.h"
+#include "http_server.h" // listen_unix_socket
+
+/*************************************************/
+
+BinSession::BinSession(int fd, DevManager * dm, size_t max_workers,
+                       const bool ws, const std::string & extra_in):
+    fd(fd), dm(dm), max_workers(max_workers), ws(ws), inbuf(extra_in),
+    idle(0), closing(false), push_wake(false), done(false){
+  cnum = dm->conn_open();
+}
+
+BinSession::~BinSession(){
+  if (reader.joinable()) reader.join();
+}
+
+void
+BinSession::start(){
+  reader = std::thread(&BinSession::read_loop, this);
+}
+
+void
+BinSession::send(const std::string & frame){
+  std::lock_guard<std::mutex> lk(wmtx);
+  if (ws) bin_write(fd, ws_frame(WS_BIN, frame.substr(4)));
+  else bin_write(fd, frame);
+}
+
+void
+BinSession::process(const BinRequest & req){
+  BinResponse resp;
+  resp.id = req.id;
+  bool log = Log::get_log_level() >= 3;
+  try {
+    if (log) Log(3) << "conn:" << cnum << " process request: /"
+                    << req.act << "/" << req.arg << "/" << req.msg;
+    resp.data = dm->run(req.act, req.arg, req.msg, req.opts, cnum);
+    if (log) Log(3) << "conn:" << cnum << " answer: " << resp.data;
+
+    // things to push
+    if (ws && (req.act == "subscribe" || req.act == "log_start" ||
+               req.act == "log_finish")){
+      std::lock_guard<std::mutex> lk(mtx);
+      if (req.act == "log_start") logs.insert(req.arg);
+      if (req.act == "log_finish") logs.erase(req.arg);
+      push_wake = true;
+      push_cv.notify_all();
+    }
+  }
+  catch (Err & e){
+    if (log) Log(3) << "conn:" << cnum << " error: " << e.str();
+    resp.err = true;
+    resp.data = e.str();
+  }
+  try {
+    send(bin_pack(resp));
+  }
+  catch (Err & e){
+    // client is gone, reader will notice it
+    Log(2) << "conn:" << cnum << " " << e.str();
+  }
+}
+
+std::deque<BinRequest>::iterator
+BinSession::next_request(){
+  for (auto i = queue.begin(); i!=queue.end(); ++i)
+    if (i->arg.empty() || busy.count(i->arg)==0) return i;
+  return queue.end();
+}
+
+void
+BinSession::work_loop(){
+  std::unique_lock<std::mutex> lk(mtx);
+  while (1){
+    idle++;
+    auto i = queue.end();
+    cv.wait(lk, [this, &i]{
+      i = next_request();
+      return i != queue.end() || (closing && queue.empty());});
+    idle--;
+    if (i == queue.end()) return; // closing
+    BinRequest req = std::move(*i);
+    queue.erase(i);
+    if (!req.arg.empty()) busy.insert(req.arg);
+    lk.unlock();
+    process(req);
+    lk.lock();
+    // requests to the device can be waiting
+    if (!req.arg.empty()){
+      busy.erase(req.arg);
+      cv.notify_all();
+    }
+  }
+}
+
+bool
+BinSession::read_request(BinRequest & req){
+  if (!ws){
+    std::string body;
+    if (!bin_read_frame(fd, body)) return false;
+    req = bin_unpack_request(body);
+    return true;
+  }
+
+  // WebSocket: collect fragments of a binary message,
+  // answer control frames
+  std::string msg;
+  bool cont = false;
+  while (1){
+    WsFrame f;
+    if (!ws_read_frame(fd, inbuf, f, BIN_MAX_FRAME)) return false;
+    switch (f.opcode){
+      case WS_PING: {
+        std::lock_guard<std::mutex> lk(wmtx);
+        bin_write(fd, ws_frame(WS_PONG, f.data));
+        continue;
+      }
+      case WS_PONG: continue;
+      case WS_CLOSE: {
+        std::lock_guard<std::mutex> lk(wmtx);
+        bin_write(fd, ws_frame(WS_CLOSE, f.data.substr(0,2)));
+        return false;
+      }
+      case WS_CONT:
+        if (!cont) throw Err() << "websocket: unexpected continuation frame";
+        break;
+      case WS_BIN:
+        if (cont) throw Err() << "websocket: unfinished message";
+        break;
+      default:
+        throw Err() << "websocket: only binary messages are supported";
+    }
+    msg += f.data;
+    if (msg.size() > BIN_MAX_FRAME)
+      throw Err() << "websocket: too long message: " << msg.size();
+    if (f.fin) break;
+    cont = true;
+  }
+  req = bin_unpack_request(msg);
+  return true;
+}
+
+void
+BinSession::read_loop(){
+  if (ws) pusher = std::thread(&BinSession::push_loop, this);
+  try {
+    BinRequest req;
+    while (read_request(req)){
+      std::lock_guard<std::mutex> lk(mtx);
+      queue.push_back(std::move(req));
+      // start a new worker if all are busy
+      if (idle < queue.size() && workers.size() < max_workers)
+        workers.emplace_back(&BinSession::work_loop, this);
+      cv.notify_one();
+    }
+  }
+  catch (Err & e){
+    Log(2) << "conn:" << cnum << " " << e.str();
+  }
+  // finish pending requests, stop workers
+  {
+    std::lock_guard<std::mutex> lk(mtx);
+    closing = true;
+  }
+  cv.notify_all();
+  push_cv.notify_all();
+  for (auto & w:workers) w.join();
+  dm->conn_close(cnum); // this also stops waiting for updates
+  if (pusher.joinable()) pusher.join();
+  Log(2) << "conn:" << cnum << " close connection";
+  done = true;
+  if (finish_cb) finish_cb();
+}
+
+// Push updates of subscriptions and device logs (WebSocket mode).
+void
+BinSession::push_loop(){
+  auto push = [this](const std::string & kind, const std::string & data){
+    if (data.empty()) return;
+    BinResponse r;
+    r.id = BIN_PUSH_ID;
+    r.data = kind + "\n" + data;
+    try { send(bin_pack(r)); }
+    catch (Err & e) {} // client is gone, reader will notice it
+  };
+
+  std::unique_lock<std::mutex> lk(mtx);
+  while (!closing){
+    push_wake = false;
+    auto devs = logs;
+    lk.unlock();
+
+    // wait for updates, check logs every 0.1s
+    bool subs = true;
+    Opt o;
+    o.put("timeout", devs.size()? 0.1: 1.0);
+    try { push("updates", dm->run("updates", "", "", o, cnum)); }
+    catch (Err & e) { subs = false; }
+    for (auto const & d: devs){
+      try { push("log " + d, dm->run("log_get", d, "", Opt(), cnum)); }
+      catch (Err & e) {}
+    }
+
+    lk.lock();
+    if (!subs && devs.empty())
+      push_cv.wait(lk, [this]{return closing || push_wake;});
+    else if (!subs)
+      push_cv.wait_for(lk, std::chrono::milliseconds(100),
+                       [this]{return closing || push_wake;});
+  }
+}
+
+/*************************************************/
+
+BinServer::BinServer(const std::string & addr, const int port,
+                     bool test, DevManager * dm):
+    dm(dm), test(test), stop(false), reap_wake(false), reap_stop(false){
+
+  struct sockaddr_in sa;
+  memset (&sa, 0, sizeof (struct sockaddr_in));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = addr=="*"? htonl(INADDR_ANY):
+                                  htonl(str_to_type_ip4(addr));
+
+  sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (sock < 0)
+    throw Err() << "can't create socket: " << strerror(errno);
+
+  int one = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(sock, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+      listen(sock, 32) < 0){
+    auto e = errno;
+    ::close(sock);
+    throw Err() << "can't listen " << addr << ":" << port << ": " << strerror(e);
+  }
+  reaper = std::thread(&BinServer::reap_loop, this);
+  thr = std::thread(&BinServer::listen_loop, this);
+}
+
+BinServer::BinServer(const std::string & path, const int mode,
+                     DevManager * dm, bool test):
+    path(path), dm(dm), test(test), stop(false),
+    reap_wake(false), reap_stop(false){
+  sock = listen_unix_socket(path, mode);
+  reaper = std::thread(&BinServer::reap_loop, this);
+  thr = std::thread(&BinServer::listen_loop, this);
+}
+
+BinServer::~BinServer(){
+  // stop accepting connections
+  stop = true;
+  shutdown(sock, SHUT_RDWR);
+  thr.join();
+  ::close(sock);
+  if (path!="") unlink(path.c_str());
+
+  // stop the reaper, close all connections
+  {
+    std::lock_guard<std::mutex> lk(conns_mutex);
+    reap_stop = true;
+    for (auto & c:conns) shutdown(c->get_fd(), SHUT_RDWR);
+  }
+  reap_cond.notify_all();
+  reaper.join();
+  reap(true);
+}
+
+// join finished connection threads (or all threads)
+void
+BinServer::reap(bool all){
+  std::list<std::shared_ptr<BinSession> > old;
+  {
+    std::lock_guard<std::mutex> lk(conns_mutex);
+    for (auto i = conns.begin(); i!=conns.end();){
+      if (all || (*i)->finished()) { old.push_back(*i); i = conns.erase(i); }
+      else ++i;
+    }
+  }
+  for (auto & c:old){
+    int fd = c->get_fd();
+    c.reset(); // wait for the session threads
+    ::close(fd);
+  }
+}
+
+void
+BinServer::reap_loop(){
+  std::unique_lock<std::mutex> lk(conns_mutex);
+  while (!reap_stop){
+    reap_cond.wait(lk, [this]{return reap_stop || reap_wake;});
+    if (reap_stop) break;
+    reap_wake = false;
+    lk.unlock();
+    reap(false);
+    lk.lock();
+  }
+}
+
+void
+BinServer::listen_loop(){
+  while (1){
+    // in test mode wait for the previous connection
+    // to have reproducible logs
+    if (test) reap(true);
+
+    struct sockaddr_storage sa;
+    socklen_t len = sizeof(sa);
+    int fd = accept(sock, (struct sockaddr *)&sa, &len);
+    if (stop) { if (fd>=0) ::close(fd); break; }
+    if (fd<0 && errno == EINTR) continue;
+    if (fd<0){
+      // e.g. too many open files: wait and try again
+      Log(1) << "binary server: accept error: " << strerror(errno);
+      usleep(100000);
+      continue;
+    }
+
+    if (sa.ss_family == AF_INET){
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    std::shared_ptr<BinSession> c(new BinSession(fd, dm, test? 1:BIN_MAX_WORKERS));
+    if (Log::get_log_level() >= 2){
+      if (sa.ss_family == AF_UNIX){
+        Log(2) << "conn:" << c->get_conn() << " open binary connection from local socket";
+      }
+      else {
+        uint32_t a = ntohl(((sockaddr_in*)&sa)->sin_addr.s_addr);
+        Log(2) << "conn:" << c->get_conn() << " open binary connection from "
+               << ((a>>24)&0xff) << "." << ((a>>16)&0xff) << "."
+               << ((a>>8)&0xff) << "." << (a&0xff);
+      }
+    }
+    c->on_finish([this]{
+      std::lock_guard<std::mutex> lk(conns_mutex);
+      reap_wake = true;
+      reap_cond.notify_all();
+    });
+    std::lock_guard<std::mutex> lk(conns_mutex);
+    conns.push_back(c);
+    c->start();
+  }
+}
@@ -0,0 +1,148 @@
+#ifndef BIN_SERVER_H
+#define BIN_SERVER_H
+
+#include <string>
+#include <list>
+#include <set>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include "dev_manager.h"
+#include "bin_proto.h"
+
+// max number of worker threads per connection
+#define BIN_MAX_WORKERS 16
+
+/*************************************************/
+// One client connection of the binary protocol.
+// Requests from users are transferred into DevManager.
+// The connection has a reader thread and a small pool of worker
+// threads, so slow requests do not block fast ones (e.g. to
+// different devices) and responses can be sent out of order.
+// Requests with the same argument (device) are processed one
+// by one in the order they were received.
+//
+// In WebSocket mode (connections upgraded by HTTP_Server) frame
+// bodies are sent as WebSocket binary messages, and a push thread
+// sends updates of subscriptions and device logs (started by
+// log_start action) to the client as BIN_PUSH_ID responses
+// (see bin_proto.h).
+
+class BinSession {
+  int fd;
+  uint64_t cnum;
+  DevManager * dm;
+  size_t max_workers;
+  bool ws;
+  std::string inbuf;            // received WebSocket data
+
+  std::thread reader;
+  std::vector<std::thread> workers;
+  std::thread pusher;
+
+  std::deque<BinRequest> queue; // requests waiting for a worker
+  std::set<std::string> busy;   // devices with running requests
+  size_t idle;                  // number of idle workers
+  bool closing;
+  bool push_wake;               // pusher should check subscriptions
+  std::set<std::string> logs;   // devices with pushed logs
+  std::mutex mtx;               // for queue, busy, idle, closing, push_wake, logs
+  std::condition_variable cv;
+  std::condition_variable push_cv;
+
+  std::mutex wmtx;              // for writing responses
+  std::atomic<bool> done;       // reader thread finished
+  std::function<void()> finish_cb;
+
+  // process a request, send the response
+  void process(const BinRequest & req);
+
+  // send a frame body
+  void send(const std::string & body);
+
+  // read next request, return false at the end
+  bool read_request(BinRequest & req);
+
+  // first queued request which can be started
+  // (its device is not busy), queue.end() if none (mtx should be locked)
+  std::deque<BinRequest>::iterator next_request();
+
+  void work_loop();
+  void read_loop();
+  void push_loop();
+
+public:
+  // Create a session for a connected socket. In WebSocket mode
+  // extra_in is data received after the HTTP request.
+  BinSession(int fd, DevManager * dm, size_t max_workers,
+             const bool ws = false, const std::string & extra_in = "");
+
+  // Wait for the session threads (the socket is not closed).
+  ~BinSession();
+
+  // Start processing requests.
+  void start();
+
+  int get_fd() const {return fd;}
+  uint64_t get_conn() const {return cnum;}
+
+  // The client closed the connection.
+  bool finished() const {return done;}
+
+  // Set a function called by the reader thread when the session
+  // is finished (before start()).
+  void on_finish(const std::function<void()> & f) {finish_cb = f;}
+};
+
+/*************************************************/
+// Server for the binary protocol (see bin_proto.h).
+
+class BinServer {
+  int sock;         // listening socket
+  std::string path; // unix socket path (empty for TCP)
+  DevManager * dm;
+  bool test;        // test mode: only one connection at a time
+  std::thread thr;  // accepting thread
+  std::atomic<bool> stop; // server is stopping
+  std::list<std::shared_ptr<BinSession> > conns;
+  std::mutex conns_mutex;  // for conns, reap_wake, reap_stop
+  std::condition_variable reap_cond;
+  bool reap_wake;          // a session has finished
+  bool reap_stop;
+  std::thread reaper;      // reaper of finished sessions
+
+  void listen_loop();
+  void reap(bool all);
+
+  // reaper thread: close sessions as soon as they finish
+  void reap_loop();
+
+  // Listen TCP port.
+  BinServer(const std::string & addr, const int port,
+            bool test, DevManager * dm);
+
+  // Listen unix domain socket.
+  BinServer(const std::string & path, const int mode,
+            DevManager * dm, bool test);
+
+public:
+  // Listen TCP port.
+  static std::unique_ptr<BinServer> tcp(const std::string & addr,
+      const int port, DevManager * dm, bool test){
+    return std::unique_ptr<BinServer>(new BinServer(addr, port, test, dm));}
+
+  // Listen unix domain socket. If mode is not 0 set permissions of
+  // the socket file. Old socket file is removed if needed.
+  static std::unique_ptr<BinServer> unix_socket(const std::string & path,
+      const int mode, DevManager * dm, bool test){
+    return std::unique_ptr<BinServer>(new BinServer(path, mode, dm, test));}
+
+  ~BinServer();
+};
+
+#endif
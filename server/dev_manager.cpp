@@ -2,6 +2,11 @@
 #include <sstream>
 #include <fstream>
 #include <iomanip>
+#include <cmath>
+#include <set>
+#include <algorithm>
+#include <chrono>
+#include <thread>
 #include <unistd.h>
 
 #include "err/err.h"
@@ -9,19 +14,201 @@
 #include "read_words/read_words.h"
 #include "drv.h"
 #include "dev_manager.h"
+#include "drv_remote.h"
 
 /*************************************************/
-DevManager::DevManager(const std::string & devfile):devfile(devfile){
+
+DevManager::DevManager(const std::string & devfile):
+    conf(new conf_t),
+    devfile(devfile), conn_counter(0), srv_stop(false), peer_period(10){
+  subs.reset(new Subscriptions(
+    [this](const std::string & dev, const std::string & msg,
+           const Driver::clock::time_point & deadline, Driver::Times & ts){
+      return get_device(dev)->poll(POLL_CONN, msg, deadline, ts);},
+    [this](const std::string & dev){
+      auto d = get_devices();
+      auto i = d->find(dev);
+      if (i != d->end()) i->second->release(POLL_CONN);}
+  ));
   try {
     read_conf();
   }
   catch (Err & e){
     Log(1) << "Can't read device list: " << e.str();
   }
+  srv_thread = std::thread(&DevManager::service_loop, this);
 }
 
 DevManager::~DevManager(){
-  for (auto & d:devices) d.second.close();
+  subs.reset(); // stop polls
+  {
+    std::lock_guard<std::mutex> lk(srv_mutex);
+    srv_stop = true;
+  }
+  srv_cond.notify_all();
+  srv_thread.join();
+  if (peers_thread.joinable()) peers_thread.join();
+  auto devs = get_devices();
+  for (auto & d:*devs) d.second->close();
+}
+
+void
+DevManager::service_loop(){
+  std::unique_lock<std::mutex> lk(srv_mutex);
+  while (!srv_stop){
+    srv_cond.wait_for(lk, std::chrono::milliseconds(500));
+    if (srv_stop) break;
+    lk.unlock();
+    auto devs = get_devices();
+    for (auto & d:*devs){
+      d.second->check_idle();
+      d.second->probe();
+    }
+    lk.lock();
+  }
+}
+
+/*************************************************/
+// timeout for getting device lists of peers, s
+#define PEER_TIMEOUT 5.0
+// timeout for forwarded requests without deadline, s
+#define FORWARD_TIMEOUT 60.0
+
+void
+DevManager::set_peers(const std::vector<std::string> & list, const double period){
+  std::vector<Peer> ps;
+  for (auto const & a: list){
+    auto p = a.rfind(':');
+    if (p == std::string::npos || p == 0 || p+1 == a.size())
+      throw Err() << "bad peer address (host:port expected): " << a;
+    Peer peer;
+    peer.addr = a.substr(0,p);
+    peer.port = a.substr(p+1);
+    peer.up = false;
+    ps.push_back(peer);
+  }
+  if (period<=0) throw Err() << "bad peer update period: " << period;
+  {
+    std::lock_guard<std::mutex> lk(peers_mutex);
+    peers = ps;
+    directory.clear();
+    peer_period = period;
+  }
+  if (ps.size() && !peers_thread.joinable())
+    peers_thread = std::thread(&DevManager::peers_loop, this);
+}
+
+void
+DevManager::peers_loop(){
+  std::unique_lock<std::mutex> lk(srv_mutex);
+  while (!srv_stop){
+    lk.unlock();
+    update_peers();
+    lk.lock();
+    if (srv_stop) break;
+    srv_cond.wait_for(lk, std::chrono::duration<double>(peer_period));
+  }
+}
+
+void
+DevManager::update_peers(){
+  std::vector<Peer> ps;
+  {
+    std::lock_guard<std::mutex> lk(peers_mutex);
+    ps = peers;
+  }
+
+  // get device lists (without locking)
+  for (auto & p: ps){
+    auto name = p.addr + ":" + p.port;
+    try {
+      auto l = remote_request(p.addr, p.port, "devices", "", "", Opt(), PEER_TIMEOUT);
+      p.devs.clear();
+      std::istringstream ss(l);
+      std::string d;
+      while (getline(ss, d)) if (d.size()) p.devs.push_back(d);
+      if (!p.up) Log(1) << "Peer " << name << " is up: "
+                        << p.devs.size() << " devices";
+      p.up = true;
+      p.err = "";
+    }
+    catch (Err & e){
+      if (p.up || p.err=="") Log(1) << "Peer " << name << " is down: " << e.str();
+      p.up = false;
+      p.err = e.str();
+      p.devs.clear();
+    }
+  }
+
+  // first peer which has the device is used
+  std::map<std::string, size_t> dir;
+  for (size_t i=0; i<ps.size(); i++)
+    for (auto const & d: ps[i].devs) dir.emplace(d, i);
+
+  std::lock_guard<std::mutex> lk(peers_mutex);
+  if (peers.size() != ps.size()) return; // peers were changed
+  peers.swap(ps);
+  directory.swap(dir);
+}
+
+std::string
+DevManager::locate(const std::string & dev){
+  std::lock_guard<std::mutex> lk(peers_mutex);
+  auto i = directory.find(dev);
+  if (i == directory.end()) return std::string();
+  return peers[i->second].addr + ":" + peers[i->second].port;
+}
+
+std::string
+DevManager::forward(const std::string & node, const std::string & act,
+                    const std::string & arg, const std::string & msg,
+                    const Opt & opts){
+  // The peer sees all forwarded requests as one connection,
+  // use/release are not needed, locks and logs can not be shared.
+  if (act == "use" || act == "release") return std::string();
+  if (act != "ask" && act != "txn" && act != "sweep" && act != "info" &&
+      act != "history")
+    throw Err() << act << ": device " << arg
+                << " belongs to another server: " << node;
+  double dl = opts.get("deadline", 0.0);
+  auto p = node.rfind(':');
+  return remote_request(node.substr(0,p), node.substr(p+1), act, arg, msg, opts,
+                        dl>0 ? dl + PEER_TIMEOUT : FORWARD_TIMEOUT);
+}
+
+/*************************************************/
+std::shared_ptr<const DevManager::dev_map_t>
+DevManager::get_devices(){
+  auto c = std::atomic_load(&conf);
+  return std::shared_ptr<const dev_map_t>(c, &c->devices);
+}
+
+std::shared_ptr<Device>
+DevManager::get_device(const std::string & name){
+  auto devs = get_devices();
+  auto i = devs->find(name);
+  if (i == devs->end())
+    throw Err() << "unknown device: " << name;
+  return i->second;
+}
+
+std::vector<std::shared_ptr<Device> >
+DevManager::get_group(const std::string & name){
+  auto c = std::atomic_load(&conf);
+  auto i = c->groups.find(name);
+  if (i == c->groups.end())
+    throw Err() << "unknown device group: " << name;
+  return i->second;
+}
+
+void
+DevManager::preopen(){
+  std::vector<std::thread> thr;
+  auto devs = get_devices();
+  for (auto & d:*devs)
+    if (d.second->get_preopen())
+      thr.emplace_back(&Device::do_preopen, d.second);
+  for (auto & t:thr) t.join();
 }
 
 /*************************************************/
@@ -41,15 +228,20 @@ DevManager::parse_url(const std::string & url){
 }
 
 /*************************************************/
-void
-DevManager::conn_open(const uint64_t conn){
+uint64_t
+DevManager::conn_open(){
+  uint64_t conn = conn_counter++;
   set_conn_name(conn);
+  return conn;
 }
 
 void
 DevManager::conn_close(const uint64_t conn){
   // go through all devices, say that we are not using them
-  for (auto & d:devices) d.second.release(conn);
+  subs->remove_conn(conn);
+  auto devs = get_devices();
+  for (auto & d:*devs) d.second->release(conn);
+  std::lock_guard<std::mutex> lk(conn_mutex);
   conn_names.erase(conn);
 }
 
@@ -64,6 +256,8 @@ DevManager::set_conn_name(const uint64_t conn,
     // if name id empty, use default value
     if (name=="") name = std::string("#") + type_to_str(conn);
 
+    std::lock_guard<std::mutex> lk(conn_mutex);
+
     // check if the name already exists:
     for (auto const & c: conn_names)
       if (c.first!=conn && c.second==name)
@@ -74,32 +268,279 @@ DevManager::set_conn_name(const uint64_t conn,
 
 
 /*************************************************/
+// optional deadline argument of ask/txn requests, seconds from now
+static Driver::clock::time_point
+get_deadline(const Opt & opts){
+  double dl = opts.get("deadline", 0.0);
+  if (dl<0) throw Err() << "bad deadline value: " << opts.get("deadline");
+  if (dl==0) return Driver::clock::time_point::max();
+  return Driver::clock::now() +
+    std::chrono::duration_cast<Driver::clock::duration>(
+      std::chrono::duration<double>(dl));
+}
+
+// max number of sweep points
+#define SWEEP_MAX 100000
+
+std::string
+DevManager::sweep(const std::string & dev, const std::string & tmpl,
+                  const Opt & opts, const uint64_t conn){
+  opts.check_unknown({"values", "from", "to", "step", "settle",
+                      "meas", "meas_dev", "deadline"});
+  auto p = tmpl.find("{}");
+  if (p == std::string::npos)
+    throw Err() << "sweep: {} expected in the command: " << tmpl;
+
+  // values: list or range
+  std::vector<std::string> vals;
+  if (opts.exists("values")){
+    if (opts.exists("from") || opts.exists("to") || opts.exists("step"))
+      throw Err() << "sweep: values and from/to/step arguments "
+                     "can not be used together";
+    auto v = opts.get("values");
+    size_t b = 0, e;
+    while ((e = v.find(',', b)) != std::string::npos){
+      vals.push_back(v.substr(b, e-b));
+      b = e+1;
+    }
+    vals.push_back(v.substr(b));
+  }
+  else {
+    if (!opts.exists("from") || !opts.exists("to") || !opts.exists("step"))
+      throw Err() << "sweep: values or from/to/step arguments expected";
+    auto v1 = opts.get<double>("from");
+    auto v2 = opts.get<double>("to");
+    auto st = opts.get<double>("step");
+    if (st==0 || (v2-v1)/st < 0)
+      throw Err() << "sweep: bad step: " << st;
+    double n = floor((v2-v1)/st + 1e-9) + 1;
+    if (n > SWEEP_MAX)
+      throw Err() << "sweep: too many points: " << n;
+    for (int i=0; i<n; i++){
+      std::ostringstream s;
+      s << std::setprecision(12) << v1 + i*st;
+      vals.push_back(s.str());
+    }
+  }
+  if (vals.size() > SWEEP_MAX)
+    throw Err() << "sweep: too many points: " << vals.size();
+
+  double settle = opts.get("settle", 0.0);
+  auto meas = opts.get("meas", "");
+  // Devices are held for the whole sweep (the device table can be
+  // replaced by reload meanwhile).
+  auto d1 = get_device(dev);
+  auto d2 = get_device(opts.get("meas_dev", dev));
+  auto deadline = get_deadline(opts);
+
+  // Each step uses the usual ask path of the devices
+  // (locking, logging, merging of queries).
+  std::string ret;
+  for (size_t i=0; i<vals.size(); i++){
+    try {
+      auto ans = d1->ask(conn, std::string(tmpl).replace(p, 2, vals[i]), deadline);
+      if (settle>0){
+        // do not wait if the request expires meanwhile
+        auto dt = std::chrono::duration_cast<Driver::clock::duration>(
+          std::chrono::duration<double>(settle));
+        if (deadline != Driver::clock::time_point::max() &&
+            Driver::clock::now() + dt > deadline)
+          throw Err() << "request deadline expired";
+        std::this_thread::sleep_for(dt);
+      }
+      if (meas!="") ans = d2->ask(conn, meas, deadline);
+      ret += vals[i] + " " + ans + "\n";
+    }
+    catch (Err & e){
+      throw Err() << "sweep: step " << i+1 << " (" << vals[i] << "): " << e.str();
+    }
+  }
+  return ret;
+}
+
+// print time as seconds with nanosecond precision
+static std::string
+print_time(const struct timespec & t){
+  std::ostringstream s;
+  s << t.tv_sec << "." << std::setfill('0') << std::setw(9) << t.tv_nsec;
+  return s.str();
+}
+
+std::string
+DevManager::group_ask(const std::string & grp, const std::string & msg,
+                      const Opt & opts, const uint64_t conn){
+  opts.check_unknown({"deadline"});
+  auto devs = get_group(grp);
+  auto deadline = get_deadline(opts);
+
+  // one message for each device, or one message for all
+  std::vector<std::string> msgs;
+  size_t b = 0, e;
+  while ((e = msg.find('\n', b)) != std::string::npos){
+    msgs.push_back(msg.substr(b, e-b));
+    b = e+1;
+  }
+  msgs.push_back(msg.substr(b));
+  if (msgs.size()==1) msgs.resize(devs.size(), msgs[0]);
+  if (msgs.size()!=devs.size())
+    throw Err() << "group_ask: " << devs.size() << " messages expected, got "
+                << msgs.size();
+
+  // Barrier: each thread locks and opens its device, then waits until
+  // all devices are ready (or failed), then all messages are sent.
+  struct Barrier {
+    std::mutex m;
+    std::condition_variable cv;
+    size_t n;
+    void arrive(){
+      std::unique_lock<std::mutex> lk(m);
+      if (--n == 0) cv.notify_all();
+    }
+    void wait(){
+      std::unique_lock<std::mutex> lk(m);
+      if (--n == 0) cv.notify_all();
+      else cv.wait(lk, [this]{return n==0;});
+    }
+  } bar;
+  bar.n = devs.size();
+
+  struct Res {
+    std::string ans, err;
+    Driver::Times ts;
+  };
+  std::vector<Res> res(devs.size());
+  std::vector<std::thread> thr;
+  for (size_t i=0; i<devs.size(); i++){
+    thr.emplace_back([&, i]{
+      bool ready = false;
+      try {
+        res[i].ans = devs[i]->ask_sync(conn, msgs[i], deadline,
+          [&]{ready = true; bar.wait();}, res[i].ts);
+      }
+      catch (Err & e){
+        res[i].err = e.str();
+        if (!ready) bar.arrive();
+      }
+    });
+  }
+  for (auto & t:thr) t.join();
+
+  std::string ret;
+  for (size_t i=0; i<devs.size(); i++){
+    if (res[i].err.size())
+      throw Err() << "group_ask: " << devs[i]->get_name() << ": " << res[i].err;
+    ret += devs[i]->get_name() + " " + print_time(res[i].ts.send.rt) + " "
+         + print_time(res[i].ts.recv.rt) + " " + res[i].ans + "\n";
+  }
+  return ret;
+}
+
 std::string
 DevManager::run(const std::string & url, const Opt & opts, const uint64_t conn){
   auto vs = parse_url(url);
-  std::string act = vs[0];
-  std::string arg = vs[1];
-  std::string msg = vs[2];
+  return run(vs[0], vs[1], vs[2], opts, conn);
+}
+
+std::string
+DevManager::run(const std::string & act, const std::string & arg,
+                const std::string & msg, const Opt & opts, const uint64_t conn){
+  std::string url = act + "/" + arg + "/" + msg; // for error messages
+
+  // requests to devices of other servers (see set_peers())
+  static const std::set<std::string> dev_acts = {"ask", "sweep", "txn",
+    "use", "release", "lock", "unlock", "log_start", "log_finish",
+    "log_get", "info", "close", "history", "subscribe"};
+  if (arg!="" && dev_acts.count(act) && get_devices()->count(arg)==0){
+    auto node = locate(arg);
+    if (node!="") return forward(node, act, arg, msg, opts);
+  }
 
   // ask/<name>/<cmd> -- send a command to the device, get answer
+  // with ts=1: "<send time> <send monotonic time> <receive time>
+  // <receive monotonic time>" line before the answer
   if (act == "ask") {
     if (arg=="")
       throw Err() << "device name expected: " << url;
-    auto lk = get_sh_lock();
-    if (devices.count(arg) == 0)
-      throw Err() << "unknown device: " << arg;
-    Device & d = devices.find(arg)->second;
-    return d.ask(conn, msg);
+    if (!opts.get("ts", false))
+      return get_device(arg)->ask(conn, msg, get_deadline(opts));
+    Driver::Times ts;
+    auto ans = get_device(arg)->ask(conn, msg, get_deadline(opts), &ts);
+    return print_time(ts.send.rt) + " " + print_time(ts.send.mono) + " "
+         + print_time(ts.recv.rt) + " " + print_time(ts.recv.mono) + "\n" + ans;
+  }
+
+  // subscribe/<name>/<msg> -- poll the device, send changed answers
+  // to this connection (see subscriptions.h), return subscription ID
+  if (act == "subscribe") {
+    if (arg=="")
+      throw Err() << "device name expected: " << url;
+    opts.check_unknown({"period", "deadband", "rel"});
+    get_device(arg); // check that the device exists
+    return std::to_string(subs->add(conn, arg, msg, opts.get("period", 1.0),
+      opts.get("deadband", 0.0), opts.get("rel", 0.0)));
+  }
+
+  // unsubscribe/<id> -- remove a subscription
+  if (act == "unsubscribe") {
+    if (arg=="")
+      throw Err() << "subscription ID expected: " << url;
+    subs->remove(conn, str_to_type<uint64_t>(arg));
+    return std::string();
+  }
+
+  // updates -- wait for changed values of subscriptions
+  if (act == "updates") {
+    opts.check_unknown({"timeout"});
+    return subs->wait(conn, opts.get("timeout", 5.0));
+  }
+
+  // subscriptions -- list of polls
+  if (act == "subscriptions") {
+    return subs->list();
+  }
+
+  // sweep/<name>/<template> -- run a sweep (see sweep())
+  if (act == "sweep") {
+    if (arg=="")
+      throw Err() << "device name expected: " << url;
+    return sweep(arg, msg, opts, conn);
+  }
+
+  // group_ask/<group>/<msg1>\n<msg2>... -- send messages to devices
+  // of the group concurrently (see group_ask())
+  if (act == "group_ask") {
+    if (arg=="")
+      throw Err() << "group name expected: " << url;
+    return group_ask(arg, msg, opts, conn);
+  }
+
+  // txn/<name>/<msg1>\n<msg2>... -- send messages to the device
+  // without other requests between them, get answers (one per line)
+  if (act == "txn") {
+    if (arg=="")
+      throw Err() << "device name expected: " << url;
+    if (msg=="")
+      throw Err() << "messages expected: " << url;
+    std::vector<std::string> msgs;
+    size_t b = 0, e;
+    while ((e = msg.find('\n', b)) != std::string::npos){
+      msgs.push_back(msg.substr(b, e-b));
+      b = e+1;
+    }
+    msgs.push_back(msg.substr(b));
+    std::string ret;
+    for (auto const & a: get_device(arg)->txn(conn, msgs, get_deadline(opts))){
+      if (ret.size()) ret += '\n';
+      ret += a;
+    }
+    return ret;
   }
 
   // use/<name> -- notify server that device should be open
   if (act == "use") {
     if (arg=="")
       throw Err() << "device name expected: " << url;
-    auto lk = get_sh_lock();
-    if (devices.count(arg) == 0)
-      throw Err() << "unknown device: " << arg;
-    devices.find(arg)->second.use(conn);
+    get_device(arg)->use(conn);
     return std::string();
   }
 
@@ -107,10 +548,7 @@ DevManager::run(const std::string & url, const Opt & opts, const uint64_t conn){
   if (act == "release") {
     if (arg=="")
       throw Err() << "device name expected: " << url;
-    auto lk = get_sh_lock();
-    if (devices.count(arg) == 0)
-      throw Err() << "unknown device: " << arg;
-    devices.find(arg)->second.release(conn);
+    get_device(arg)->release(conn);
     return std::string();
   }
 
@@ -118,10 +556,7 @@ DevManager::run(const std::string & url, const Opt & opts, const uint64_t conn){
   if (act == "lock") {
     if (arg=="")
       throw Err() << "device name expected: " << url;
-    auto lk = get_sh_lock();
-    if (devices.count(arg) == 0)
-      throw Err() << "unknown device: " << arg;
-    devices.find(arg)->second.lock(conn);
+    get_device(arg)->lock(conn);
     return std::string();
   }
 
@@ -129,10 +564,7 @@ DevManager::run(const std::string & url, const Opt & opts, const uint64_t conn){
   if (act == "unlock") {
     if (arg=="")
       throw Err() << "device name expected: " << url;
-    auto lk = get_sh_lock();
-    if (devices.count(arg) == 0)
-      throw Err() << "unknown device: " << arg;
-    devices.find(arg)->second.unlock(conn);
+    get_device(arg)->unlock(conn);
     return std::string();
   }
 
@@ -140,10 +572,7 @@ DevManager::run(const std::string & url, const Opt & opts, const uint64_t conn){
   if (act == "log_start") {
     if (arg=="")
       throw Err() << "device name expected: " << url;
-    auto lk = get_sh_lock();
-    if (devices.count(arg) == 0)
-      throw Err() << "unknown device: " << arg;
-    devices.find(arg)->second.log_start(conn);
+    get_device(arg)->log_start(conn);
     return std::string();
   }
 
@@ -151,10 +580,7 @@ DevManager::run(const std::string & url, const Opt & opts, const uint64_t conn){
   if (act == "log_finish") {
     if (arg=="")
       throw Err() << "device name expected: " << url;
-    auto lk = get_sh_lock();
-    if (devices.count(arg) == 0)
-      throw Err() << "unknown device: " << arg;
-    devices.find(arg)->second.log_finish(conn);
+    get_device(arg)->log_finish(conn);
     return std::string();
   }
 
@@ -163,20 +589,26 @@ DevManager::run(const std::string & url, const Opt & opts, const uint64_t conn){
   if (act == "log_get") {
     if (arg=="")
       throw Err() << "device name expected: " << url;
-    auto lk = get_sh_lock();
-    if (devices.count(arg) == 0)
-      throw Err() << "unknown device: " << arg;
-    return devices.find(arg)->second.log_get(conn);
+    return get_device(arg)->log_get(conn);
+  }
+
+  // history/<name> -- get recorded traffic of the device
+  if (act == "history") {
+    if (arg=="")
+      throw Err() << "device name expected: " << url;
+    opts.check_unknown({"from", "to", "limit", "msg", "bucket", "agg"});
+    if (opts.exists("agg") && !opts.exists("bucket"))
+      throw Err() << "history: agg argument requires bucket";
+    return get_device(arg)->history(opts.get("from", 0.0),
+      opts.get("to", 1e10), opts.get("limit", (size_t)100000),
+      opts.get("msg", ""), opts.get("bucket", 0.0), opts.get("agg", "mean"));
   }
 
   // info/<name> -- print device <name> information
   if (act == "info") {
     if (arg=="")
       throw Err() << "device name expected: " << url;
-    auto lk = get_sh_lock();
-    if (devices.count(arg) == 0)
-      throw Err() << "unknown device: " << arg;
-    return devices.find(arg)->second.print(conn);
+    return get_device(arg)->print(conn);
   }
 
   // devices, list -- list all available devices
@@ -184,26 +616,53 @@ DevManager::run(const std::string & url, const Opt & opts, const uint64_t conn){
     if (arg!="")
       throw Err() << "unexpected argument: " << url;
     std::string ret;
-    for (auto const & d:devices)
+    auto devs = get_devices();
+    for (auto const & d:*devs)
       ret += d.first + "\n";
     return ret;
   }
 
+  // locate/<name> -- server which has the device
+  // (empty for local devices)
+  if (act == "locate") {
+    if (arg=="")
+      throw Err() << "device name expected: " << url;
+    if (get_devices()->count(arg)) return std::string();
+    auto node = locate(arg);
+    if (node=="") throw Err() << "unknown device: " << arg;
+    return node;
+  }
+
+  // peers -- list of other servers and their devices
+  if (act == "peers") {
+    if (arg!="")
+      throw Err() << "unexpected argument: " << url;
+    std::ostringstream ss;
+    std::lock_guard<std::mutex> lk(peers_mutex);
+    for (auto const & p: peers){
+      ss << p.addr << ":" << p.port;
+      if (p.up){
+        ss << " up:";
+        for (auto const & d: p.devs) ss << " " << d;
+      }
+      else ss << " down: " << p.err;
+      ss << "\n";
+    }
+    return ss.str();
+  }
+
   // reload -- reload device list
   if (act == "reload"){
     read_conf();
     return std::string("Device configuration reloaded: ") +
-      type_to_str(devices.size()) + " devices";
+      type_to_str(get_devices()->size()) + " devices";
   }
 
   // close -- close device (it will be reopened if needed)
   if (act == "close"){
     if (arg=="")
       throw Err() << "device name expected: " << url;
-    auto lk = get_sh_lock();
-    if (devices.count(arg) == 0)
-      throw Err() << "unknown device: " << arg;
-    devices.find(arg)->second.close();
+    get_device(arg)->close();
     return std::string();
   }
 
@@ -235,6 +694,7 @@ DevManager::run(const std::string & url, const Opt & opts, const uint64_t conn){
   if (act == "get_conn_name"){
     if (arg!="")
       throw Err() << "unexpected argument: " << arg;
+    std::lock_guard<std::mutex> lk(conn_mutex);
     return conn_names[conn];
   }
 
@@ -243,6 +703,7 @@ DevManager::run(const std::string & url, const Opt & opts, const uint64_t conn){
     if (arg!="")
       throw Err() << "unexpected argument: " << arg;
     std::ostringstream ss;
+    std::lock_guard<std::mutex> lk(conn_mutex);
     for (auto const & c: conn_names) ss << c.second << "\n";
     return ss.str();
   }
@@ -251,7 +712,8 @@ DevManager::run(const std::string & url, const Opt & opts, const uint64_t conn){
   if (act == "release_all"){
     if (arg!="")
       throw Err() << "unexpected argument: " << arg;
-    for (auto & d:devices) d.second.release(conn);
+    auto devs = get_devices();
+    for (auto & d:*devs) d.second->release(conn);
     set_conn_name(conn);
     return std::string();
   }
@@ -262,7 +724,11 @@ DevManager::run(const std::string & url, const Opt & opts, const uint64_t conn){
 /*************************************************/
 void
 DevManager::read_conf(){
-  std::map<std::string, Device> ret;
+  std::lock_guard<std::mutex> clk(conf_mutex);
+  std::shared_ptr<conf_t> c(new conf_t);
+  auto ret  = &c->devices;
+  auto grps = &c->groups;
+  std::map<std::string, std::vector<std::string> > grp_devs;
   int line_num[2] = {0,0};
   std::ifstream ff(devfile);
   if (!ff.good()) throw Err()
@@ -297,12 +763,27 @@ DevManager::read_conf(){
         opt.put(vs[i].substr(1), vs[i+1]);
       }
 
-      // does this device exists
-      if (ret.count(dev)>0) throw Err()
+      // does this device (or group) exists
+      if (ret->count(dev)>0 || grp_devs.count(dev)>0) throw Err()
         << "duplicated device name: " << dev;
 
+      // device group
+      if (drv == "group"){
+        opt.check_unknown({"devices"});
+        auto & v = grp_devs[dev];
+        std::istringstream ss(opt.get("devices"));
+        std::string n;
+        while (ss >> n){
+          if (std::find(v.begin(), v.end(), n) != v.end())
+            throw Err() << "duplicated device in group " << dev << ": " << n;
+          v.push_back(n);
+        }
+        if (v.size()==0) throw Err() << "empty device group: " << dev;
+        continue;
+      }
+
       // add device information
-      ret.emplace(dev, Device(dev,drv,opt));
+      ret->emplace(dev, std::make_shared<Device>(dev,drv,opt));
 
     }
   } catch (Err e){
@@ -310,9 +791,26 @@ DevManager::read_conf(){
                 << devfile << " at line " << line_num[0] << ": " << e.str();
   }
 
-  Log(1) << ret.size() << " devices configured";
+  // groups can refer to any devices in the file
+  for (auto const & g: grp_devs){
+    auto & v = (*grps)[g.first];
+    for (auto const & n: g.second){
+      auto i = ret->find(n);
+      if (i == ret->end()) throw Err() << "bad configuration file "
+        << devfile << ": unknown device in group " << g.first << ": " << n;
+      v.push_back(i->second);
+    }
+  }
+
+  Log(1) << ret->size() << " devices configured";
+
+  // apply the configuration only if no errors have found.
+  auto old = std::atomic_exchange(&conf, std::shared_ptr<const conf_t>(c));
+
+  // close old devices, requests which are still using
+  // them will not reopen them
+  for (auto & d:old->devices) d.second->retire();
 
-  auto lk = get_lock();
-  devices = ret; // apply the configuration only if no errors have found.
+  preopen();
 }
 
@@ -9,34 +9,117 @@
 #include <vector>
 #include <string>
 #include <memory>
-#include <shared_mutex> // C++14
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <mutex>
 
 #include "err/err.h"
 #include "log/log.h"
 #include "opt/opt.h"
 #include "device.h"
+#include "subscriptions.h"
 
 class DevManager {
-
-  // All devices (from configuration file):
-  std::map<std::string, Device> devices;
-
-  // Mutex for locking data
-  typedef std::shared_timed_mutex mutex_t;
-  mutex_t data_mutex;
-
-  // Get lock for the mutex (for writers)
-  std::unique_lock<mutex_t> get_lock() {
-    return std::unique_lock<mutex_t>(data_mutex);}
-
-  // Get shared lock for the mutex (for readers)
-  std::shared_lock<mutex_t> get_sh_lock() {
-    return std::shared_lock<mutex_t>(data_mutex);}
+public:
+  // Device table
+  typedef std::map<std::string, std::shared_ptr<Device> > dev_map_t;
+
+  // Device groups (`<name> group -devices <list>` lines in the
+  // configuration file): group name -> devices
+  typedef std::map<std::string, std::vector<std::shared_ptr<Device> > > group_map_t;
+
+private:
+  // Configuration: all devices (from configuration file) and device
+  // groups. It is never modified, read_conf() publishes a new one with
+  // a single atomic store, so groups always refer to devices of the same
+  // table. Requests use snapshots of the configuration, an old one (and
+  // its devices) is deleted when the last request using it finishes.
+  struct conf_t {
+    dev_map_t devices;
+    group_map_t groups;
+  };
+  std::shared_ptr<const conf_t> conf; // std::atomic_load/atomic_store
+
+  // Mutex for serializing configuration updates
+  std::mutex conf_mutex;
+
+  // Get current snapshot of the device table. Keep the returned pointer
+  // while using the table: a reload can replace the snapshot.
+  std::shared_ptr<const dev_map_t> get_devices();
+
+  // Find a device in the current snapshot. The device stays alive while
+  // the pointer is kept. Throw Err if the device is unknown.
+  std::shared_ptr<Device> get_device(const std::string & name);
+
+  // Find a device group. Throw Err if the group is unknown.
+  std::vector<std::shared_ptr<Device> > get_group(const std::string & name);
 
   std::string devfile; // device list file
 
   // connection names
   std::map<uint64_t, std::string> conn_names;
+  std::mutex conn_mutex;
+
+  // connection counter (shared by all servers)
+  std::atomic<uint64_t> conn_counter;
+
+  // Service thread: closing idle devices, reopening failed ones.
+  std::thread srv_thread;
+  std::mutex srv_mutex;
+  std::condition_variable srv_cond;
+  bool srv_stop;
+  void service_loop();
+
+  // Open all devices with -preopen parameter in parallel.
+  void preopen();
+
+  // Federation: other servers ("host:port" of their binary protocol
+  // ports) and the directory of their devices. The peers thread gets
+  // the device list of each peer every peer_period seconds; peers which
+  // do not answer are marked as down and their devices are removed
+  // from the directory. Requests to these devices are forwarded.
+  struct Peer {
+    std::string addr, port;
+    bool up;
+    std::string err;               // error if the peer is down
+    std::vector<std::string> devs; // devices of the peer
+  };
+  std::vector<Peer> peers;
+  std::map<std::string, size_t> directory; // device -> peer index
+  std::mutex peers_mutex;
+  double peer_period;
+  std::thread peers_thread;
+  void peers_loop();
+
+  // Update peer states and the directory.
+  void update_peers();
+
+  // Find a peer which has the device, return "host:port"
+  // (empty string if there is no such peer).
+  std::string locate(const std::string & dev);
+
+  // Send a request for a device of another server.
+  std::string forward(const std::string & node, const std::string & act,
+                      const std::string & arg, const std::string & msg,
+                      const Opt & opts);
+
+  // Change-driven subscriptions. Polls use connection
+  // POLL_CONN (see subscriptions.h).
+  static const uint64_t POLL_CONN = UINT64_MAX-1;
+  std::unique_ptr<Subscriptions> subs;
+
+  // sweep/<dev>/<template> action: for each value send the template
+  // with {} replaced by the value, wait, send measurement command,
+  // return "<value> <answer>" lines.
+  std::string sweep(const std::string & dev, const std::string & tmpl,
+                    const Opt & opts, const uint64_t conn);
+
+  // group_ask/<group>/<messages> action: send messages to all devices
+  // of the group concurrently, return "<device> <send time> <receive time>
+  // <answer>" lines.
+  std::string group_ask(const std::string & grp, const std::string & msg,
+                        const Opt & opts, const uint64_t conn);
 
 public:
 
@@ -46,11 +129,15 @@ public:
   // Destructor. Close all devices
   ~DevManager();
 
+  // Set list of other servers ("host:port" of their binary protocol
+  // ports), start updating the device directory every period seconds.
+  void set_peers(const std::vector<std::string> & list, const double period);
+
   // number of devices (for tests)
-  size_t size() const {return devices.size();}
+  size_t size() {return get_devices()->size();}
 
-  // open connection callback:
-  void conn_open(const uint64_t conn);
+  // open connection callback, return new connection ID:
+  uint64_t conn_open();
 
   // close connection callback:
   void conn_close(const uint64_t conn);
@@ -66,7 +153,12 @@ public:
   // - act:  action (URL without arguments in GET request)
   // - opts: options (arguments from the url)
   // - conn: connection ID
-  std::string run(const std::string & act, const Opt & opts, const uint64_t conn);
+  std::string run(const std::string & url, const Opt & opts, const uint64_t conn);
+
+  // Same, but with url already split into action, argument and message
+  // (used by servers with other protocols).
+  std::string run(const std::string & act, const std::string & arg,
+                  const std::string & msg, const Opt & opts, const uint64_t conn);
 
   // Read configuration file, update `devices` map.
   // Throw exception on errors.
@@ -3,6 +3,11 @@
 #include "dev_manager.h"
 #include "err/assert_err.h"
 #include <cassert>
+#include <cmath>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <unistd.h>
 
 using namespace std;
 
@@ -94,6 +99,206 @@ main(){
     // error does not change configuration
     assert_eq(dm.size(), 2);
 
+    assert_err(dm.read_conf("test_data/e8.txt"),
+      "bad configuration file test_data/e8.txt at line 2: "
+      "bad -idle_close value: -1");
+
+    // open/close policies are not passed to drivers
+    dm.read_conf("test_data/n4.txt");
+    assert_eq(dm.run("info/a", Opt(), 1),
+      "Device: a\nDriver: test\nDevice is closed\nNumber of users: 0\n"
+      "Open policy: preopen close on release\n");
+    assert_eq(dm.run("info/b", Opt(), 1),
+      "Device: b\nDriver: test\nDriver arguments:\n  -a: b\n"
+      "Device is closed\nNumber of users: 0\nOpen policy: idle_close 0.5 s\n");
+    assert_eq(dm.run("ask/b/x", Opt(), 1), "x");
+    assert_eq(dm.run("ask/b/y", Opt(), 1), "y");
+
+    // locking; connection is registered again after release
+    dm.run("lock/b", Opt(), 1);
+    assert_err(dm.run("ask/b/x", Opt(), 2), "device is locked");
+    assert_err(dm.run("unlock/b", Opt(), 2),
+      "device is locked by another connection");
+    dm.run("release/b", Opt(), 1); // release unlocks the device
+    assert_eq(dm.run("ask/b/z", Opt(), 2), "z");
+    assert_err(dm.run("lock/b", Opt(), 1),
+      "Can't lock the device: it is in use");
+    dm.run("release/b", Opt(), 2);
+    dm.run("release/b", Opt(), 1);
+
+    // concurrent requests, opening and closing the device
+    {
+      std::vector<std::thread> thr;
+      std::atomic<int> n(0);
+      for (int i=0; i<8; i++) thr.emplace_back([&dm, &n, i]{
+        for (int j=0; j<200; j++){
+          if (dm.run("ask/a/q", Opt(), 10+i) == "q") n++;
+          if (j%10 == 9) dm.run("release/a", Opt(), 10+i);
+        }
+      });
+      for (auto & t:thr) t.join();
+      assert_eq(n.load(), 1600);
+    }
+
+    // circuit breaker: errors of the device are not counted,
+    // connection errors are
+    dm.read_conf("test_data/n5.txt");
+    assert_eq(dm.run("ask/c/a", Opt(), 1), "Q: a");
+    assert_err(dm.run("ask/c/error", Opt(), 1), "some error");
+    assert_err(dm.run("ask/c/error", Opt(), 1), "some error");
+    assert_err(dm.run("ask/c/error", Opt(), 1), "some error");
+    assert_eq(dm.run("ask/c/b", Opt(), 1), "Q: b");
+    assert_err(dm.run("ask/c/exit", Opt(), 1),
+      "SPP: unexpected EOF: test_data/spp.sh");
+    assert_err(dm.run("ask/c/x", Opt(), 1),
+      "spp: test_data/spp.sh: program has exited or reported a fatal error");
+    assert_err(dm.run("ask/c/c", Opt(), 1),
+      "device is not available: spp: test_data/spp.sh: "
+      "program has exited or reported a fatal error");
+    assert(dm.run("info/c", Opt(), 2).find(
+      "Circuit breaker: 2 of 2 failures, device is not available") != string::npos);
+    usleep(1500000); // service thread reopens the device
+    assert_eq(dm.run("ask/c/d", Opt(), 1), "Q: d");
+    assert(dm.run("info/c", Opt(), 2).find(
+      "Circuit breaker: 0 of 2 failures\n") != string::npos);
+
+    // device closed on release while the breaker is open
+    // is reopened as well
+    dm.read_conf("test_data/n8.txt");
+    assert_err(dm.run("ask/c/exit", Opt(), 1),
+      "SPP: unexpected EOF: test_data/spp.sh");
+    assert_err(dm.run("ask/c/x", Opt(), 1),
+      "spp: test_data/spp.sh: program has exited or reported a fatal error");
+    dm.run("release/c", Opt(), 1);
+    assert_err(dm.run("ask/c/c", Opt(), 1),
+      "device is not available: spp: test_data/spp.sh: "
+      "program has exited or reported a fatal error");
+    usleep(1500000);
+    assert_eq(dm.run("ask/c/d", Opt(), 1), "Q: d");
+    dm.read_conf("test_data/n5.txt");
+
+    // transactions
+    assert_eq(dm.run("txn/c/x\ny", Opt(), 1), "Q: x\nQ: y");
+    assert_err(dm.run("txn/c", Opt(), 1), "messages expected: txn/c/");
+    assert_err(dm.run("txn/c/a\nerror\nb", Opt(), 1),
+      "message 2: some error");
+
+    // merging of queries (test driver returns the compound
+    // query, it is split back)
+    dm.read_conf("test_data/n6.txt");
+    assert_eq(dm.run("ask/m/a?", Opt(), 1), "a?");
+    assert_eq(dm.run("ask/m/b", Opt(), 1), "b");
+    {
+      std::vector<std::thread> thr;
+      std::atomic<int> n(0), nm(0);
+      for (int i=0; i<8; i++) thr.emplace_back([&dm, &n, &nm, i]{
+        auto q = "q" + type_to_str(i) + "?";
+        auto a = dm.run("ask/m/" + q, Opt(), 10+i);
+        if (a == q) n++;
+        if (a == ":" + q) {n++; nm++;}
+      });
+      for (auto & t:thr) t.join();
+      assert_eq(n.load(), 8);
+      assert(nm.load() > 0);
+    }
+
+    // request which expires while the leader waits
+    // for more queries is dropped from the queue at its deadline
+    {
+      std::string a1;
+      std::thread t1([&dm, &a1]{ a1 = dm.run("ask/m/a?", Opt(), 10); });
+      usleep(10000);
+      Opt o;
+      o.put("deadline", 0.02);
+      auto t0 = std::chrono::steady_clock::now();
+      assert_err(dm.run("ask/m/b?", o, 11), "request deadline expired");
+      auto dt = std::chrono::steady_clock::now() - t0;
+      assert(dt < std::chrono::milliseconds(35)); // merge_window is 50ms
+      t1.join();
+      assert_eq(a1, "a?");
+    }
+
+    // sweeps
+    {
+      Opt o;
+      o.put("values", "1,2.5");
+      assert_eq(dm.run("sweep/m/V {}", o, 1), "1 V 1\n2.5 V 2.5\n");
+      o.put("meas", "M?");
+      o.put("settle", "0.01");
+      assert_eq(dm.run("sweep/m/V {}", o, 1), "1 M?\n2.5 M?\n");
+      o.put("settle", "0.5");
+      o.put("deadline", "0.1");
+      assert_err(dm.run("sweep/m/V {}", o, 1),
+        "sweep: step 1 (1): request deadline expired");
+      o.erase("deadline");
+      o.put("settle", "0.01");
+      o.put("from", "0");
+      assert_err(dm.run("sweep/m/V {}", o, 1),
+        "sweep: values and from/to/step arguments can not be used together");
+
+      Opt o1;
+      o1.put("from", "0");
+      o1.put("to", "0.3");
+      o1.put("step", "0.1");
+      assert_eq(dm.run("sweep/m/V {}", o1, 1), "0 V 0\n0.1 V 0.1\n0.2 V 0.2\n0.3 V 0.3\n");
+      o1.put("step", "-0.1");
+      assert_err(dm.run("sweep/m/V {}", o1, 1), "sweep: bad step: -0.1");
+      assert_err(dm.run("sweep/m/V", o1, 1), "sweep: {} expected in the command: V");
+      o1.put("meas_dev", "x");
+      o1.put("step", "0.1");
+      assert_err(dm.run("sweep/m/V {}", o1, 1), "unknown device: x");
+    }
+
+
+    // device groups
+    assert_err(dm.read_conf("test_data/e9.txt"),
+      "bad configuration file test_data/e9.txt: "
+      "unknown device in group g: x");
+    assert_err(dm.read_conf("test_data/e10.txt"),
+      "bad configuration file test_data/e10.txt at line 2: "
+      "duplicated device in group g: a");
+    dm.read_conf("test_data/n7.txt");
+    assert_eq(dm.size(), 2);
+    {
+      auto r = dm.run("group_ask/g/x\ny", Opt(), 1);
+      std::istringstream ss(r);
+      std::string d1, d2, a1, a2;
+      double s1, r1, s2, r2;
+      ss >> d1 >> s1 >> r1 >> a1 >> d2 >> s2 >> r2;
+      getline(ss, a2);
+      assert_eq(d1, "a"); assert_eq(a1, "x");
+      assert_eq(d2, "b"); assert_eq(a2, " Q: y");
+      assert(s1 <= r1 && s2 <= r2);
+      assert(fabs(s1-s2) < 0.1);
+
+      r = dm.run("group_ask/g/z", Opt(), 1);
+      assert(r.find(" z\n") != string::npos);
+      assert(r.find(" Q: z\n") != string::npos);
+    }
+
+    // timestamps
+    {
+      Opt o;
+      o.put("ts", 1);
+      for (auto const & d: {"a", "b"}){
+        auto r = dm.run(std::string("ask/") + d + "/t?", o, 1);
+        std::istringstream ss(r);
+        double s1, s2, r1, r2;
+        std::string a;
+        ss >> s1 >> s2 >> r1 >> r2;
+        getline(ss, a); // end of the first line
+        getline(ss, a);
+        assert(s1 > 1e9 && s1 <= r1 && s2 <= r2);
+        assert(fabs((r1-s1) - (r2-s2)) < 0.01);
+        assert(a == "t?" || a == "Q: t?");
+      }
+    }
+    assert_err(dm.run("group_ask/g/x\ny\nz", Opt(), 1),
+      "group_ask: 2 messages expected, got 3");
+    assert_err(dm.run("group_ask/g/x\nerror", Opt(), 1),
+      "group_ask: b: some error");
+    assert_err(dm.run("group_ask/a/x", Opt(), 1),
+      "unknown device group: a");
   }
   catch (Err e) {
     std::cerr << "Error: " << e.str() << "\n";
@@ -1,43 +1,267 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <thread>
 #include <unistd.h>
 
 #include "err/err.h"
 #include "log/log.h"
 #include "read_words/read_words.h"
+#include "drv_utils.h"
 #include "device.h"
 
+// max number of queries merged into one compound query
+#define MERGE_MAX 16
+
 /*************************************************/
+// Per-thread cache of registered (device, connection) pairs.
+// An entry is valid while the device epoch does not change.
+// Epochs are taken from a global counter, so an entry can not
+// match a new device created at the same address.
+namespace {
+struct RegEntry {
+  const void * dev;
+  uint64_t conn;
+  uint64_t epoch;
+};
+thread_local RegEntry reg_cache[8];
+std::atomic<uint64_t> epoch_counter(0);
+
+RegEntry & reg_slot(const void * dev, const uint64_t conn){
+  return reg_cache[((uintptr_t)dev/sizeof(void*) ^ conn) & 7];
+}
+}
+
+/*************************************************/
+const uint64_t Device::NO_OWNER;
+
 Device::Device( const std::string & dev_name,
         const std::string & drv_name,
         const Opt & drv_args):
+  state(CLOSED),
+  open_attempt(0),
+  nusers(0),
+  epoch(++epoch_counter),
+  lock_owner(NO_OWNER),
   dev_name(dev_name),
   drv_name(drv_name),
   drv_args(drv_args),
-  locked(false),
+  nfails(0),
+  probe_time(0),
+  merge_leader(false),
+  last_use(0),
+  retired(false),
+  nlog_bufs(0),
   max_log_size(1024) {
+
+  // open/close policies, they are not passed to the driver
+  preopen    = this->drv_args.get("preopen", false);
+  keep_open  = this->drv_args.get("keep_open", true);
+  idle_close = this->drv_args.get("idle_close", 0.0);
+  if (idle_close < 0) throw Err()
+    << "bad -idle_close value: " << idle_close;
+  this->drv_args.erase("preopen");
+  this->drv_args.erase("keep_open");
+  this->drv_args.erase("idle_close");
+
+  // circuit breaker parameters, also not passed to the driver
+  fail_max     = this->drv_args.get("fail_max", 0u);
+  fail_backoff = this->drv_args.get("fail_backoff", 10.0);
+  if (fail_backoff <= 0) throw Err()
+    << "bad -fail_backoff value: " << fail_backoff;
+  this->drv_args.erase("fail_max");
+  this->drv_args.erase("fail_backoff");
+
+  // merging of queries
+  merge_window = this->drv_args.get("merge_window", -1.0);
+  merge_sep    = this->drv_args.get("merge_sep", ";");
+  this->drv_args.erase("merge_window");
+  this->drv_args.erase("merge_sep");
+
+  // recording of the traffic
+  if (this->drv_args.exists("record")){
+    auto seg = this->drv_args.get("record_seg", 64.0);
+    if (seg <= 0) throw Err() << "bad -record_seg value: " << seg;
+    rec.reset(new Recorder(this->drv_args.get("record"), seg*(1<<20)));
+  }
+  this->drv_args.erase("record");
+  this->drv_args.erase("record_seg");
+}
+
+// time after now, in Driver::clock ticks
+static Driver::clock::rep
+time_after(const double dt){
+  return (Driver::clock::now() +
+    std::chrono::duration_cast<Driver::clock::duration>(
+      std::chrono::duration<double>(dt))).time_since_epoch().count();
+}
+
+void
+Device::req_failed(const std::string & msg){
+  if (fail_max==0 || ++nfails != fail_max) return;
+  // open the breaker: close the driver, requests will fail until
+  // the service thread reopens it
+  std::unique_lock<std::mutex> lk(state_mutex);
+  state_cond.wait(lk, [this]{return state != OPENING && state != CLOSING;});
+  open_error = msg;
+  probe_time = time_after(fail_backoff);
+  Log(1) << "device " << dev_name << ": " << nfails << " failures, "
+         << "stop using it for " << fail_backoff << " s: " << msg;
+  if (state != OPEN) { state = FAILING; return; }
+  state = CLOSING;
+  auto d = std::atomic_exchange(&drv, std::shared_ptr<Driver>());
+  lk.unlock();
+  d.reset();
+  lk.lock();
+  state = FAILING;
+  state_cond.notify_all();
+}
+
+std::shared_ptr<Driver>
+Device::get_drv(const uint64_t conn, const bool pre, const bool probe){
+  // fast path: device is open
+  if (state == OPEN){
+    auto d = std::atomic_load(&drv);
+    if (d) return d;
+  }
+
+  std::unique_lock<std::mutex> lk(state_mutex);
+
+  // breaker is open: fail immediately
+  if (!probe && tripped())
+    throw Err() << "device is not available: " << open_error;
+
+  // wait for open/close in other threads
+  if (state == OPENING || state == CLOSING){
+    auto att = open_attempt;
+    state_cond.wait(lk, [this]{return state != OPENING && state != CLOSING;});
+    // the attempt we waited for failed
+    if (state == FAILING && open_attempt == att)
+      throw Err() << open_error;
+  }
+  if (state == OPEN) return std::atomic_load(&drv);
+  if (retired) throw Err() << "device configuration has been changed";
+
+  // open the driver without holding the lock
+  state = OPENING;
+  open_attempt++;
+  lk.unlock();
+  std::shared_ptr<Driver> d;
+  try {
+    d = Driver::create(drv_name, drv_args);
+  }
+  catch (Err & e){
+    lk.lock();
+    open_error = e.str();
+    state = FAILING;
+    if (fail_max>0 && ++nfails >= fail_max){
+      probe_time = time_after(fail_backoff);
+      if (nfails == fail_max) Log(1) << "device " << dev_name << ": "
+        << nfails << " failures, stop using it for " << fail_backoff
+        << " s: " << open_error;
+    }
+    state_cond.notify_all();
+    throw;
+  }
+  last_use = Driver::clock::now().time_since_epoch().count();
+  std::atomic_store(&drv, d);
+  lk.lock();
+  state = OPEN;
+  nfails = 0;
+  state_cond.notify_all();
+  lk.unlock();
+  if (pre) Log(2) << "preopen device: " << dev_name;
+  else if (probe) Log(1) << "device " << dev_name << " is available again";
+  else Log(2) << "conn:" << conn << " open device: " << dev_name;
+  return d;
 }
 
-Device::Device(const Device & d){
-  users = d.users;
-  drv = d.drv;
-  dev_name = d.dev_name;
-  drv_name = d.drv_name;
-  drv_args = d.drv_args;
-  locked = d.locked;
-  max_log_size = d.max_log_size;
+bool
+Device::close_drv(const bool unused){
+  std::unique_lock<std::mutex> lk(state_mutex);
+  state_cond.wait(lk, [this]{return state != OPENING && state != CLOSING;});
+  if (state != OPEN) {
+    // keep FAILING state of the tripped breaker: the service thread
+    // reopens the device (see probe())
+    if (state != FAILING || !tripped()) state = CLOSED;
+    return false;
+  }
+  if (unused && nusers>0) return false;
+
+  // destroy the driver without holding the lock: it can take time,
+  // new requests wait until it is finished (the device can not be
+  // opened twice)
+  state = CLOSING;
+  auto d = std::atomic_exchange(&drv, std::shared_ptr<Driver>());
+  lk.unlock();
+  d.reset();
+  lk.lock();
+  state = CLOSED;
+  state_cond.notify_all();
+  return true;
 }
 
 void
 Device::use(const uint64_t conn){
-  if (users.count(conn)>0) return; // device is opened and used by this connection
-  if (locked) throw Err() << "device is locked";
+  // fast path: connection is registered in this thread
+  auto & r = reg_slot(this, conn);
+  if (r.dev == this && r.conn == conn && r.epoch == epoch) return;
+
   auto lk = get_data_lock();
-  if (!drv) { // device needs to be opened
-    drv = Driver::create(drv_name, drv_args);
-    Log(2) << "conn:" << conn << " open device: " << dev_name;
+  if (users.count(conn)==0){
+    auto o = lock_owner.load();
+    if (o != NO_OWNER && o != conn) throw Err() << "device is locked";
+    // open the device without holding data_mutex
+    lk.unlock();
+    get_drv(conn);
+    lk.lock();
+    o = lock_owner.load();
+    if (o != NO_OWNER && o != conn) throw Err() << "device is locked";
+    if (users.insert(conn).second) nusers++;
+  }
+  r.dev = this;
+  r.conn = conn;
+  r.epoch = epoch;
+}
+
+void
+Device::do_preopen(){
+  if (!preopen || state != CLOSED) return;
+  try {
+    get_drv(0, true);
+  }
+  catch (Err & e){
+    Log(1) << "can't open device " << dev_name << ": " << e.str();
+  }
+}
+
+void
+Device::check_idle(){
+  if (idle_close<=0 || state != OPEN) return;
+  auto idle = [this](){
+    auto dt = Driver::clock::now().time_since_epoch().count() - last_use;
+    return std::chrono::duration<double>(Driver::clock::duration(dt)).count() >= idle_close;
+  };
+  if (!idle()) return;
+
+  // do not wait for running requests
+  std::unique_lock<std::timed_mutex> clk(cmd_mutex, std::try_to_lock);
+  if (!clk.owns_lock()) return;
+  if (!idle()) return; // device could be used while we were waiting
+  if (close_drv()) Log(2) << "Close idle device: " << dev_name;
+}
+
+void
+Device::probe(){
+  if (!tripped() || state != FAILING || retired) return;
+  if (Driver::clock::now().time_since_epoch().count() < probe_time) return;
+  try {
+    get_drv(0, false, true);
+  }
+  catch (Err & e){
+    Log(2) << "can't reopen device " << dev_name << ": " << e.str();
   }
-  users.insert(conn);
 }
 
 void
@@ -45,55 +269,77 @@ Device::release(const uint64_t conn){
   auto lk = get_data_lock();
 
   // remove log buffer
-  if (log_bufs.count(conn)>0)
+  if (log_bufs.count(conn)>0){
     log_bufs.erase(conn);
+    nlog_bufs = log_bufs.size();
+  }
 
   // device is not used by this connection
-  if (users.count(conn)==0) return;
+  if (users.erase(conn)==0) return;
+  nusers--;
+  epoch = ++epoch_counter;
+
+  auto o = conn;
+  lock_owner.compare_exchange_strong(o, NO_OWNER);
 
-  if (locked) locked = false;
-  users.erase(conn);
+  // close the device if it is not used anymore
+  if (keep_open || !users.empty()) return;
+  lk.unlock();
+  if (close_drv(true))
+    Log(2) << "conn:" << conn << " close device: " << dev_name;
 }
 
 void
 Device::close(){
-  auto lk = get_data_lock();
-  log_bufs.clear();
-  users.clear();
-  if (locked) locked = false;
-  drv.reset();
+  {
+    auto lk = get_data_lock();
+    log_bufs.clear();
+    nlog_bufs = 0;
+    users.clear();
+    nusers = 0;
+    epoch = ++epoch_counter;
+    lock_owner = NO_OWNER;
+  }
+  nfails = 0; // reset the breaker
+  close_drv();
   Log(2) << "Close device: " << dev_name;
 }
 
+void
+Device::retire(){
+  retired = true;
+  close();
+}
+
 void
 Device::lock(const uint64_t conn){
   // to lock the device we should be its only user.
-  if (users.count(conn)==0) use(conn);
+  use(conn);
   auto lk = get_data_lock();
   if (users.size()!=1)
     throw Err() << "Can't lock the device: it is in use";
-  locked = true;
+  lock_owner = conn;
 }
 
 void
 Device::unlock(const uint64_t conn){
-  auto lk = get_data_lock();
-  if (!locked) return;
-  if (users.count(conn)==0)
-    throw Err() << "device is locked by another connection";
-  locked = false;
+  auto o = conn;
+  if (lock_owner.compare_exchange_strong(o, NO_OWNER) || o == NO_OWNER) return;
+  throw Err() << "device is locked by another connection";
 }
 
 void
 Device::log_start(const uint64_t conn){
   auto lk = get_data_lock();
   log_bufs[conn] = log_buf_t();
+  nlog_bufs = log_bufs.size();
 }
 
 void
 Device::log_finish(const uint64_t conn){
   auto lk = get_data_lock();
   log_bufs.erase(conn);
+  nlog_bufs = log_bufs.size();
 }
 
 std::string
@@ -111,6 +357,7 @@ Device::log_get(const uint64_t conn){
 
 void
 Device::log_message(const std::string & pref, const std::string & msg){
+  auto lk = get_data_lock();
   if (log_bufs.size()==0) return;
   // make shared_ptr to share it between log buffers
   std::shared_ptr<std::string> s(new std::string);
@@ -122,31 +369,245 @@ Device::log_message(const std::string & pref, const std::string & msg){
   }
 }
 
+std::unique_lock<std::timed_mutex>
+Device::get_cmd_lock(const Driver::clock::time_point & deadline){
+  if (deadline == Driver::clock::time_point::max())
+    return std::unique_lock<std::timed_mutex>(cmd_mutex);
+  std::unique_lock<std::timed_mutex> lk(cmd_mutex, std::defer_lock);
+  if (!lk.try_lock_until(deadline) || Driver::clock::now() >= deadline)
+    throw Err() << "request deadline expired";
+  return lk;
+}
+
 // Send message to the device, get answer
 std::string
-Device::ask(const uint64_t conn, const std::string & msg){
+Device::ask(const uint64_t conn, const std::string & msg,
+            const Driver::clock::time_point & deadline, Driver::Times * ts){
+
+  // register the connection and open device if needed
+  use(conn);
+
+  // drivers which process requests in parallel (spp with -workers)
+  // are not serialized
+  if (get_drv(conn)->parallel())
+    return do_ask(conn, msg, deadline, ts);
 
-  // open device if needed
-  if (users.count(conn)==0) use(conn);
+  if (!ts && merge_window>=0 && scpi_mergeable(msg))
+    return ask_merged(conn, msg, deadline);
 
-  auto lk = get_cmd_lock();
+  // requests which can not be started before the
+  // deadline are dropped here
+  auto lk = get_cmd_lock(deadline);
+  return do_ask(conn, msg, deadline, ts);
+}
 
-  // if no logging is needed just return answer
-  if (log_bufs.size()==0) return drv->ask(msg);
+std::vector<std::string>
+Device::txn(const uint64_t conn, const std::vector<std::string> & msgs,
+            const Driver::clock::time_point & deadline){
+  use(conn);
+  auto lk = get_cmd_lock(deadline);
+  std::vector<std::string> ret;
+  for (size_t i=0; i<msgs.size(); i++){
+    try {
+      ret.push_back(do_ask(conn, msgs[i], deadline));
+    }
+    catch (Err & e){
+      throw Err() << "message " << i+1 << ": " << e.str();
+    }
+  }
+  return ret;
+}
+
+std::string
+Device::ask_sync(const uint64_t conn, const std::string & msg,
+                 const Driver::clock::time_point & deadline,
+                 const std::function<void()> & ready, Driver::Times & ts){
+  use(conn);
+  get_drv(conn); // open the device before waiting for others
+  // wait without holding cmd_mutex: other requests to the device
+  // should not be blocked by the group
+  ready();
+  auto lk = get_cmd_lock(deadline);
+  return do_ask(conn, msg, deadline, &ts);
+}
+
+std::string
+Device::poll(const uint64_t conn, const std::string & msg,
+             const Driver::clock::time_point & deadline, Driver::Times & ts){
+  use(conn);
+  auto lk = get_cmd_lock(deadline);
+  return do_ask(conn, msg, deadline, &ts, REC_POLL);
+}
+
+// realtime of a time stamp, ns
+static int64_t
+ts_ns(const Driver::TimeStamp & t){
+  return t.rt.tv_sec*1000000000LL + t.rt.tv_nsec;
+}
+
+std::string
+Device::do_ask(const uint64_t conn, const std::string & msg,
+               const Driver::clock::time_point & deadline, Driver::Times * ts,
+               const int rtype){
+
+  // get the driver, reopen it if it was closed after inactivity
+  auto d = get_drv(conn);
+  last_use = Driver::clock::now().time_since_epoch().count();
+
+  // pass deadline to the driver, reset it after the request
+  struct DeadlineGuard {
+    Driver & d;
+    DeadlineGuard(Driver & d, const Driver::clock::time_point & t): d(d) {
+      d.set_deadline(t);}
+    ~DeadlineGuard() {d.set_deadline(Driver::clock::time_point::max());}
+  } dg(*d, deadline);
+
+  // timestamps are also needed for recording
+  Driver::Times trec;
+  if (rec && !ts) ts = &trec;
+
+  // if no logging, breaker or timestamps are needed just return answer
+  if (nlog_bufs==0 && fail_max==0 && !ts) return d->ask(msg);
+
+  // Timestamps: reset driver times, take our own ones
+  // for drivers which do not set them.
+  Driver::Times t0;
+  if (ts) {d->times = Driver::Times(); t0.send.set();}
 
   // do all logging (message, answer, errors)
-  log_message(">> ", msg);
+  bool logging = nlog_bufs>0;
+  if (logging) log_message(">> ", msg);
   try {
-    auto ret = drv->ask(msg);
-    log_message("<< ", ret);
+    auto ret = d->ask(msg);
+    if (ts) {
+      t0.recv.set();
+      *ts = d->times;
+      if (ts->send.empty()) ts->send = t0.send;
+      if (ts->recv.empty()) ts->recv = t0.recv;
+    }
+    if (rec) rec->add(rtype, ts_ns(ts->send), ts_ns(ts->recv), msg, ret);
+    if (logging) log_message("<< ", ret);
+    req_ok();
     return ret;
   }
   catch (Err & e) {
-    log_message("EE ", e.str());
+    if (rec) {
+      Driver::TimeStamp t;
+      t.set();
+      rec->add(REC_ERR, ts_ns(t0.send), ts_ns(t), msg, e.str());
+    }
+    if (logging) log_message("EE ", e.str());
+    // errors of the device or of the request are not counted
+    if (e.code()==DRV_CONN_LOST || e.code()==DRV_CONN_ERR) req_failed(e.str());
     throw;
   }
 }
 
+std::string
+Device::ask_merged(const uint64_t conn, const std::string & msg,
+                   const Driver::clock::time_point & deadline){
+  // The first queued request (leader) waits merge_window and then
+  // cmd_mutex, others wait for the leader. When the device is free the
+  // leader takes all queued requests and sends them as one query.
+  // Requests which come after this choose a new leader.
+  MergeReq r(conn, msg, deadline);
+  std::unique_lock<std::mutex> mlk(merge_mutex);
+  merge_queue.push_back(&r);
+  while (!r.done){
+    if (merge_leader || !r.queued){
+      // A queued request waits until its deadline. A request taken
+      // by the leader is referenced by the batch, run_merged()
+      // finishes it (dropping it if its deadline is expired).
+      if (!r.queued || deadline == Driver::clock::time_point::max())
+        merge_cond.wait(mlk);
+      else if (merge_cond.wait_until(mlk, deadline) == std::cv_status::timeout
+               && r.queued){
+        merge_queue.erase(std::find(merge_queue.begin(), merge_queue.end(), &r));
+        throw Err() << "request deadline expired";
+      }
+      continue;
+    }
+    merge_leader = true;
+    mlk.unlock();
+
+    // collect more queries without holding cmd_mutex
+    if (merge_window>0)
+      std::this_thread::sleep_until(std::min(deadline, Driver::clock::now() +
+        std::chrono::duration_cast<Driver::clock::duration>(
+          std::chrono::duration<double>(merge_window))));
+
+    std::unique_lock<std::timed_mutex> clk;
+    try {
+      clk = get_cmd_lock(deadline);
+    }
+    catch (Err & e){
+      // deadline expired: remove the request, let others choose a new leader
+      mlk.lock();
+      merge_leader = false;
+      merge_queue.erase(std::find(merge_queue.begin(), merge_queue.end(), &r));
+      merge_cond.notify_all();
+      throw;
+    }
+
+    mlk.lock();
+    auto n = std::min(merge_queue.size(), (size_t)MERGE_MAX);
+    std::vector<MergeReq*> batch(merge_queue.begin(), merge_queue.begin()+n);
+    merge_queue.erase(merge_queue.begin(), merge_queue.begin()+n);
+    for (auto b: batch) b->queued = false;
+    merge_leader = false;
+    merge_cond.notify_all();
+    mlk.unlock();
+
+    run_merged(batch);
+    clk.unlock();
+
+    mlk.lock();
+    for (auto b: batch) b->done = true;
+    merge_cond.notify_all();
+  }
+  mlk.unlock();
+  if (r.failed) throw Err() << r.err;
+  return r.ans;
+}
+
+void
+Device::run_merged(std::vector<MergeReq*> & batch){
+  // drop requests which are already expired
+  std::vector<MergeReq*> live;
+  auto now = Driver::clock::now();
+  for (auto b: batch){
+    if (b->deadline > now) { live.push_back(b); continue; }
+    b->failed = true;
+    b->err = "request deadline expired";
+  }
+
+  if (live.size()>1){
+    std::vector<std::string> msgs;
+    auto deadline = live[0]->deadline;
+    for (auto b: live){
+      msgs.push_back(b->msg);
+      deadline = std::min(deadline, b->deadline);
+    }
+    try {
+      auto ans = scpi_split(do_ask(live[0]->conn, scpi_merge(msgs), deadline), merge_sep);
+      if (ans.size() == live.size()){
+        for (size_t i=0; i<live.size(); i++) live[i]->ans = ans[i];
+        return;
+      }
+    }
+    catch (Err & e) {}
+  }
+  for (auto b: live){
+    try {
+      b->ans = do_ask(b->conn, b->msg, b->deadline);
+    }
+    catch (Err & e){
+      b->failed = true;
+      b->err = e.str();
+    }
+  }
+}
+
 std::string
 Device::print(const uint64_t conn) const {
   std::ostringstream s;
@@ -156,11 +617,75 @@ Device::print(const uint64_t conn) const {
     s << "Driver arguments:\n";
   for (auto const & o:drv_args)
     s << "  -" << o.first << ": " << o.second << "\n";
+  auto lk = get_data_lock();
   s << "Device is " << (users.size()>0 ? "open":"closed") << "\n";
   s << "Number of users: " << users.size() << "\n";
   if (conn && users.count(conn))
     s << "You are currently using the device\n";
-  if (locked)
+  if (lock_owner != NO_OWNER)
     s << "Device is locked\n";
+  if (preopen || !keep_open || idle_close>0){
+    s << "Open policy:";
+    if (preopen) s << " preopen";
+    if (!keep_open) s << " close on release";
+    if (idle_close>0) s << " idle_close " << idle_close << " s";
+    s << "\n";
+  }
+  if (merge_window>=0)
+    s << "Query merging: window " << merge_window << " s, separator \""
+      << merge_sep << "\"\n";
+  if (fail_max>0){
+    s << "Circuit breaker: " << nfails << " of " << fail_max << " failures";
+    if (tripped()){
+      auto dt = probe_time - Driver::clock::now().time_since_epoch().count();
+      s << ", device is not available, next attempt in "
+        << std::max(0.0, std::chrono::duration<double>(
+             Driver::clock::duration(dt)).count()) << " s";
+      std::lock_guard<std::mutex> slk(state_mutex);
+      s << "\nLast error: " << open_error;
+    }
+    s << "\n";
+  }
+  if (rec){
+    s << "Recording to " << rec->get_dir();
+    if (rec->dropped()) s << ", " << rec->dropped() << " records dropped";
+    auto e = rec->error();
+    if (e.size()) s << "\nRecording error: " << e;
+    s << "\n";
+  }
+  return s.str();
+}
+
+std::string
+Device::history(const double from, const double to, const size_t limit,
+                const std::string & msg, const double bucket,
+                const std::string & agg){
+  if (!rec) throw Err() << "recording is off (see -record parameter)";
+  // limits in ns (avoid overflow)
+  auto ns = [](double t) -> int64_t {
+    if (t >= 9e9) return INT64_MAX;
+    if (t <= 0) return 0;
+    return int64_t(t*1e9);
+  };
+
+  if (bucket>0){
+    if (bucket < 1e-9) throw Err() << "bad bucket size: " << bucket;
+    RecAgg a(ns(bucket), agg, limit);
+    rec->scan(ns(from), ns(to), [&](const Record & r){
+      if (r.type == REC_ERR || (msg.size() && r.msg != msg)) return true;
+      return a.add(r.t2, r.ans);
+    });
+    return a.print();
+  }
+
+  std::ostringstream s;
+  size_t n = 0;
+  rec->scan(ns(from), ns(to), [&](const Record & r){
+    if (msg.size() && r.msg != msg) return true;
+    s << rec_time(r.t2) << "\t"
+      << (r.type==REC_ASK? "ask": r.type==REC_ERR? "err": "poll") << "\t"
+      << rec_escape(r.msg) << "\t" << rec_escape(r.ans) << "\n";
+    return !limit || ++n < limit;
+  });
   return s.str();
 }
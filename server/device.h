@@ -4,13 +4,19 @@
 #include <set>
 #include <map>
 #include <queue>
+#include <vector>
 #include <string>
 #include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
 
 #include "err/err.h"
 #include "opt/opt.h"
 #include "drv.h"
-#include <mutex>
+#include "recorder.h"
 
 /*************************************************/
 
@@ -19,14 +25,42 @@
 
 class Device {
 
-  // Device driver (non-null if device is in use)
+  // Device state:
+  //   CLOSED  -- driver is not created;
+  //   OPENING -- one thread is creating the driver, others wait for it;
+  //   OPEN    -- driver is ready;
+  //   FAILING -- last attempt to open the driver failed;
+  //   CLOSING -- driver is being destroyed.
+  enum state_t {CLOSED, OPENING, OPEN, FAILING, CLOSING};
+  std::atomic<int> state;
+
+  // Device driver (non-null in OPEN state). Accessed
+  // with std::atomic_load/atomic_store.
   std::shared_ptr<Driver> drv;
 
-  // Connections which use the device
+  // Mutex and condition variable for state transitions
+  // (OPENING and CLOSING are waited for, not repeated).
+  mutable std::mutex state_mutex;
+  std::condition_variable state_cond;
+
+  // Number of the open attempt and the last error (protected by
+  // state_mutex). Requests which waited for a failed attempt get its
+  // error instead of trying again.
+  uint64_t open_attempt;
+  std::string open_error;
+
+  // Connections which use the device (protected by data_mutex)
   std::set<uint64_t> users;
+  std::atomic<size_t> nusers;
 
-  // Is the device locked by a single user?
-  bool locked;
+  // Registration epoch. It is changed when users are removed;
+  // connections registered in the current epoch (see reg_cache in
+  // device.cpp) are not looked up in the users set.
+  std::atomic<uint64_t> epoch;
+
+  // Connection which locked the device (NO_OWNER if not locked)
+  static const uint64_t NO_OWNER = UINT64_MAX;
+  std::atomic<uint64_t> lock_owner;
 
   // Device name
   std::string dev_name;
@@ -35,19 +69,100 @@ class Device {
   std::string drv_name;
   Opt drv_args;
 
-  // Mutex for locking device data
-  std::mutex data_mutex;
+  // Open/close policies (-preopen, -keep_open, -idle_close
+  // parameters in the configuration file, not passed to the driver)
+  bool preopen;      // open the device when configuration is read
+  bool keep_open;    // do not close the device when last user releases it
+  double idle_close; // close the device after inactivity, s (if >0)
+
+  // Circuit breaker (-fail_max, -fail_backoff parameters). After
+  // fail_max consecutive failures (of opening, or connection errors of
+  // requests: DRV_CONN_LOST, DRV_CONN_ERR codes) the device is closed,
+  // requests fail immediately, and the service thread tries to reopen
+  // it every fail_backoff seconds.
+  unsigned fail_max;    // 0 -- do not use the breaker
+  double fail_backoff;
+  std::atomic<unsigned> nfails; // number of consecutive failures
+  std::atomic<Driver::clock::rep> probe_time; // time of the next reopen attempt
+
+  // Is the breaker open (device is not used)?
+  bool tripped() const {return fail_max>0 && nfails>=fail_max;}
+
+  // Register a failure/success of a request.
+  void req_failed(const std::string & msg);
+  void req_ok() { if (nfails) nfails = 0; }
+
+  // Merging of SCPI queries (-merge_window, -merge_sep parameters).
+  // Queries waiting for the device are sent as one compound
+  // query, the answer is split by merge_sep.
+  double merge_window;    // additional time to collect queries, s (<0 -- do not merge)
+  std::string merge_sep;  // separator of answers
+
+  struct MergeReq {
+    uint64_t conn;
+    std::string msg, ans, err;
+    Driver::clock::time_point deadline;
+    bool queued, failed, done;
+    MergeReq(const uint64_t conn, const std::string & msg,
+             const Driver::clock::time_point & deadline):
+      conn(conn), msg(msg), deadline(deadline),
+      queued(true), failed(false), done(false) {}
+  };
+  std::vector<MergeReq*> merge_queue; // queries waiting for the device
+  bool merge_leader; // one of queued requests is waiting for cmd_mutex
+  std::mutex merge_mutex;
+  std::condition_variable merge_cond;
+
+  // Send a query, merging it with others (see merge_window).
+  std::string ask_merged(const uint64_t conn, const std::string & msg,
+                         const Driver::clock::time_point & deadline);
+
+  // Send a batch of queries (cmd_mutex should be locked), set answers or
+  // errors. Queries with expired deadlines are dropped, the compound
+  // query uses the earliest deadline of the others. If it fails or its
+  // answer can not be split queries are sent one by one.
+  void run_merged(std::vector<MergeReq*> & batch);
+
+  // Send message to the driver (cmd_mutex should be locked).
+  // If ts is not NULL, write send/receive times there.
+  // rtype is the record type for the recorder (REC_ASK or REC_POLL).
+  std::string do_ask(const uint64_t conn, const std::string & msg,
+                     const Driver::clock::time_point & deadline,
+                     Driver::Times * ts = NULL, const int rtype = REC_ASK);
+
+  // Recorder of device traffic (-record, -record_seg parameters),
+  // NULL if recording is off.
+  std::unique_ptr<Recorder> rec;
+
+  // Time of the last request (Driver::clock ticks)
+  std::atomic<Driver::clock::rep> last_use;
+
+  // Device is removed from the configuration, it can not be opened.
+  std::atomic<bool> retired;
+
+  // Open the driver if needed, return it. Only one thread creates
+  // the driver, concurrent callers wait for the result.
+  // Probe is a reopen attempt when the breaker is open.
+  std::shared_ptr<Driver> get_drv(const uint64_t conn,
+    const bool pre = false, const bool probe = false);
+
+  // Destroy the driver (if unused is set, only if there are no users).
+  // Return true if the device was open.
+  bool close_drv(const bool unused = false);
+
+  // Mutex for locking device data (users, log buffers)
+  mutable std::mutex data_mutex;
 
   // Get lock for the mutex
-  std::unique_lock<std::mutex> get_data_lock() {
+  std::unique_lock<std::mutex> get_data_lock() const {
     return std::unique_lock<std::mutex>(data_mutex);}
 
   // Mutex for locking write+read commands
-  std::mutex cmd_mutex;
+  std::timed_mutex cmd_mutex;
 
-  // Get lock for the mutex
-  std::unique_lock<std::mutex> get_cmd_lock() {
-    return std::unique_lock<std::mutex>(cmd_mutex);}
+  // Get lock for the mutex, wait until the deadline.
+  std::unique_lock<std::timed_mutex> get_cmd_lock(
+      const Driver::clock::time_point & deadline);
 
   // Log buffers: conn -> list(shared_ptr(strings))
   // Each connection can start its own log buffer and
@@ -55,6 +170,7 @@ class Device {
   // shared_ptr is used to share messages between log buffers.
   typedef std::queue<std::shared_ptr<std::string> > log_buf_t;
   std::map<uint64_t, log_buf_t> log_bufs;
+  std::atomic<size_t> nlog_bufs; // log_bufs.size(), for checking without lock
 
   // Max number of lines in the log
   size_t max_log_size;
@@ -68,9 +184,6 @@ public:
           const std::string & drv_name,
           const Opt & drv_args);
 
-  // Copy constructor
-  Device(const Device & d);
-
   // Start using the device by a connection.
   // Open it if nobody else use it.
   void use(const uint64_t conn);
@@ -82,6 +195,28 @@ public:
   // Close device.
   void close();
 
+  // Close device and do not allow to open it again
+  // (used when device is removed from configuration).
+  void retire();
+
+  // Device name
+  const std::string & get_name() const {return dev_name;}
+
+  // Does the device have -preopen parameter?
+  bool get_preopen() const {return preopen;}
+
+  // Open the device if it has -preopen parameter.
+  // Errors are written to the log.
+  void do_preopen();
+
+  // Close the device if it was not used for idle_close time.
+  // Do nothing if the device is busy.
+  void check_idle();
+
+  // Try to reopen the device if the breaker is open and
+  // fail_backoff time passed after the last attempt.
+  void probe();
+
   // Lock device by a connection.
   // It can be done only if the connection is the only user of the device.
   // If device is locked other connections can not use it.
@@ -101,8 +236,47 @@ public:
   // Get contents of the log buffer and clear it.
   std::string log_get(const uint64_t conn);
 
-  // Send message to the device, get answer
-  std::string ask(const uint64_t conn, const std::string & msg);
+  // Send message to the device, get answer.
+  // If deadline is set, the request is dropped if it can not be started
+  // before the deadline, and the driver read is interrupted at the deadline
+  // (if the driver supports it).
+  // If ts is not NULL, times of sending the message and receiving the
+  // answer are written there (taken by the driver around write and read,
+  // or around the whole request if the driver does not support it);
+  // such requests are not merged.
+  std::string ask(const uint64_t conn, const std::string & msg,
+    const Driver::clock::time_point & deadline = Driver::clock::time_point::max(),
+    Driver::Times * ts = NULL);
+
+  // Send a few messages to the device without other requests
+  // between them, get all answers. Stop on the first error.
+  std::vector<std::string> txn(const uint64_t conn,
+    const std::vector<std::string> & msgs,
+    const Driver::clock::time_point & deadline = Driver::clock::time_point::max());
+
+  // Send message to the device, get answer (used for synchronized requests
+  // to device groups). When the device is open, ready() is called (it can
+  // wait for other devices), then the message is sent.
+  // Send and receive times are written to ts (see ask()).
+  std::string ask_sync(const uint64_t conn, const std::string & msg,
+    const Driver::clock::time_point & deadline,
+    const std::function<void()> & ready, Driver::Times & ts);
+
+  // Send a message for a subscription poll (see subscriptions.h):
+  // same as ask() with timestamps, but the request is recorded
+  // as REC_POLL and never merged with others.
+  std::string poll(const uint64_t conn, const std::string & msg,
+    const Driver::clock::time_point & deadline, Driver::Times & ts);
+
+  // Get recorded traffic with receive times in [from, to] (unix seconds),
+  // at most limit records: "<time>\t<type>\t<message>\t<answer>" lines,
+  // type is ask, err or poll; tabs, newlines and backslashes in messages
+  // are escaped. If msg is not empty, only records with this message
+  // are used. If bucket>0 (seconds), numeric answers are aggregated
+  // in time buckets instead (see RecAgg), limit is the number of buckets.
+  std::string history(const double from, const double to, const size_t limit,
+                      const std::string & msg = "", const double bucket = 0,
+                      const std::string & agg = "mean");
 
   // Print device information: name, users, driver, driver arguments.
   std::string print(const uint64_t conn=0) const;
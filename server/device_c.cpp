@@ -1,10 +1,22 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <cstring>
 #include <unistd.h> // usleep
+#include <fcntl.h>
+#include <poll.h>
+#include <map>
+#include <set>
+#include <queue>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include <curl/curl.h>
 #include "tun.h"
+#include "bin_client.h"
 
 #include "read_words/read_words.h"
 #include "read_words/read_conf.h"
@@ -12,6 +24,8 @@
 #include "getopt/help_printer.h"
 #include "err/err.h"
 
+// batch action: max number of input lines read ahead of printed answers
+#define BATCH_WINDOW 1024
 
 /*************************************************/
 // print help message
@@ -19,13 +33,22 @@ void usage(const GetOptSet & options, bool pod=false){
   HelpPrinter pr(pod, options, "device_c");
   pr.name("device client program");
   pr.usage("[<options>] ask <dev> <msg> -- send message to the device, print answer");
+  pr.usage("[<options>] txn <dev> <msg1> <msg2> ... -- send messages without other requests between them, print answers");
+  pr.usage("[<options>] group_ask <group> <msg1> ... -- send messages to devices of a group simultaneously, print answers with timestamps");
+  pr.usage("[<options>] sweep <dev> <cmd> <arg>=<val> ... -- run a sweep on the server (see sweep action)");
+  pr.usage("[<options>] history <dev> <arg>=<val> ... -- print recorded traffic of the device (see history action)");
   pr.usage("[<options>] use_dev <dev>   -- SPP interface to a device");
   pr.usage("[<options>] use_srv         -- SPP interface to the server");
+  pr.usage("[<options>] batch [<file>]  -- run \"ask <dev> <msg>\" lines from a file or stdin in parallel");
   pr.usage("[<options>] (list|devices)  -- print list of available devices");
   pr.usage("[<options>] info <dev>      -- print information about device");
+  pr.usage("[<options>] locate <dev>    -- print address of the server which has the device");
+  pr.usage("[<options>] peers           -- print list of other servers and their devices");
   pr.usage("[<options>] reload          -- reload device configuration");
   pr.usage("[<options>] close <dev>     -- close device (it will be reopened if needed)");
   pr.usage("[<options>] monitor <dev>   -- monitor all communication of the device");
+  pr.usage("[<options>] subscribe <dev> <msg> <arg>=<val> ... -- print changed answers of a polled message (see subscribe action)");
+  pr.usage("[<options>] subscriptions   -- print list of subscription polls");
   pr.usage("[<options>] ping            -- check if the server is working");
   pr.usage("[<options>] get_time        -- get server system time");
   pr.usage("[<options>] get_srv         -- get server address");
@@ -45,39 +68,89 @@ size_t write_cb(void *buffer, size_t size, size_t nmemb, void *data){
 }
 
 class Downloader {
-  CURLM *cm;
+  CURL *cm;
   std::string server;
+  std::string sock; // unix socket path (if not empty)
+  std::unique_ptr<BinClient> bin; // binary protocol client (if not empty)
+  Opt ask_args; // arguments for ask requests
+
+  // build url from action, device and command
+  std::string make_url(const std::string & act,
+                       const std::string & dev,
+                       const std::string & cmd,
+                       const Opt & args = Opt()){
+    // escape url components
+    char *dev_ = curl_easy_escape(cm, dev.data() , dev.size());
+    char *act_ = curl_easy_escape(cm, act.data() , act.size());
+    char *cmd_ = curl_easy_escape(cm, cmd.data() , cmd.size());
+
+    // build url, free unneeded strings
+    std::string url = server + "/" + act_;
+    if  (dev != "") url += std::string("/") + dev_;
+    if  (cmd != "") url += std::string("/") + cmd_;
+    curl_free(dev_);
+    curl_free(act_);
+    curl_free(cmd_);
+
+    // request arguments
+    char sep = '?';
+    for (auto const & a:req_args(act, args)){
+      char *k = curl_easy_escape(cm, a.first.data(), a.first.size());
+      char *v = curl_easy_escape(cm, a.second.data(), a.second.size());
+      url += sep + std::string(k) + "=" + v;
+      curl_free(k);
+      curl_free(v);
+      sep = '&';
+    }
+    return url;
+  }
+
+  // request arguments: ask_args are used for ask, txn, sweep
+  // and group_ask actions
+  Opt req_args(const std::string & act, const Opt & args){
+    Opt ret(args);
+    if (act == "ask" || act == "txn" || act == "sweep" || act == "group_ask")
+      for (auto const & a:ask_args) ret.put(a.first, a.second);
+    return ret;
+  }
 
 public:
 
-  Downloader(const std::string & srv): server(srv){
-    curl_global_init(CURL_GLOBAL_ALL);
+  // Note: curl_global_init should be called once before.
+  // If sock is not empty, connect to the server through
+  // the unix domain socket.
+  Downloader(const std::string & srv, const std::string & sock = ""):
+      server(srv), sock(sock){
     cm = curl_easy_init();
+    if (sock!="") curl_easy_setopt(cm, CURLOPT_UNIX_SOCKET_PATH, sock.c_str());
   }
 
   ~Downloader(){
     curl_easy_cleanup(cm);
   }
 
+  // Set argument for ask and txn requests (e.g. deadline).
+  void set_ask_arg(const std::string & name, const std::string & val) {
+    ask_args.put(name, val);}
+
+  // Use binary protocol instead of HTTP (see bin_proto.h).
+  // Name is used as server address in SPP headers.
+  void use_bin(BinClient * b, const std::string & name) {
+    bin.reset(b);
+    server = name;
+  }
+
   // ask the server
   std::string get(const std::string & act,
                   const std::string & dev = "",
-                  const std::string & cmd = ""){
-    // escape url components
-    char *dev_ = curl_easy_escape(cm, dev.data() , dev.size());
-    char *act_ = curl_easy_escape(cm, act.data() , act.size());
-    char *cmd_ = curl_easy_escape(cm, cmd.data() , cmd.size());
+                  const std::string & cmd = "",
+                  const Opt & args = Opt()){
 
-    // build url, free unneeded strings
-    std::string url = server + "/" + act_;
-    if  (dev != "") url += std::string("/") + dev_;
-    if  (cmd != "") url += std::string("/") + cmd_;
-    curl_free(dev_);
-    curl_free(act_);
-    curl_free(cmd_);
+    if (bin) return bin->get(act, dev, cmd, req_args(act, args));
 
     // set curl options
     std::string data; // data storage
+    std::string url = make_url(act, dev, cmd, args);
     curl_easy_setopt(cm, CURLOPT_URL, url.c_str());
     curl_easy_setopt(cm, CURLOPT_WRITEFUNCTION, write_cb);
     curl_easy_setopt(cm, CURLOPT_WRITEDATA, (void*) &data);
@@ -91,6 +164,244 @@ public:
     return data;
   }
 
+  // Run many "ask <dev> <msg>" commands in parallel. Each line is sent
+  // as soon as it is read. With HTTP a pool of max_conn persistent
+  // connections is used, requests to different devices run concurrently,
+  // requests to the same device are sent one after another in the input
+  // order. With binary protocol all requests are sent through one
+  // connection without waiting (the server keeps order of requests to
+  // each device). Answers are printed in the input order as soon as they
+  // are ready, each one followed by #OK or #Error line (as in use_dev).
+  // At most BATCH_WINDOW lines are read ahead of the printed answers.
+  // The input stream is shared with the reading thread (it can
+  // outlive the call if it is blocked in reading).
+  void batch(const std::shared_ptr<std::istream> & in,
+             std::ostream & out, const int max_conn){
+
+    struct job_t {
+      std::string dev, msg, data;
+      int state; // 0: waiting, 1: in progress, 2: done, 3: error
+      job_t(): state(0) {}
+    };
+
+    // State shared with the input thread. Jobs which are not printed
+    // yet are kept in a deque (references to its elements are not
+    // invalidated when new jobs are added). The input thread wakes
+    // the main one through a pipe.
+    struct batch_t {
+      std::deque<job_t> jobs;
+      size_t nout;   // number of printed jobs (index of jobs.front())
+      bool eof, stop;
+      std::mutex m;  // for jobs, nout, eof, stop
+      std::condition_variable cv;
+      int wake[2];
+      batch_t(): nout(0), eof(false), stop(false) {
+        if (pipe(wake)) throw Err() << "pipe: " << strerror(errno);
+        fcntl(wake[0], F_SETFL, O_NONBLOCK);
+      }
+      ~batch_t(){ ::close(wake[0]); ::close(wake[1]); }
+      job_t & job(const size_t n) {return jobs[n-nout];}
+      size_t njobs() const {return nout + jobs.size();}
+      void drain() { char b[256]; while (::read(wake[0], b, sizeof(b))>0); }
+    };
+    auto st = std::make_shared<batch_t>();
+
+    std::thread reader([st, in](){
+      while (1){
+        {
+          std::unique_lock<std::mutex> lk(st->m);
+          st->cv.wait(lk, [&st]{return st->stop || st->jobs.size() < BATCH_WINDOW;});
+          if (st->stop) return;
+        }
+        job_t j;
+        std::vector<std::string> pars;
+        bool eof = false;
+        try {
+          pars = read_words(*in);
+          if (pars.size()==0) eof = true;
+          else if (pars[0] != "ask"){
+            j.state = 3;
+            j.data = "ask action expected: " + pars[0];
+          }
+          else if (pars.size()<3){
+            j.state = 3;
+            j.data = "not enough parameters for \"ask\" action";
+          }
+          else {
+            j.dev = pars[1];
+            j.msg = join_words(std::vector<std::string>(pars.begin()+2, pars.end()));
+          }
+        }
+        catch (Err & e){
+          j.state = 3;
+          j.data = e.str();
+          eof = true;
+        }
+        {
+          std::lock_guard<std::mutex> lk(st->m);
+          if (j.state!=0 || !eof) st->jobs.push_back(j);
+          st->eof = eof;
+        }
+        if (::write(st->wake[1], "", 1)<0) {}
+        if (eof) return;
+      }
+    });
+
+    // print finished answers in the input order (st->m should be locked)
+    auto print = [&](){
+      bool done = false;
+      while (st->jobs.size() && st->jobs.front().state>1){
+        auto & j = st->jobs.front();
+        if (j.state==2) out << j.data << "\n#OK\n";
+        else out << "#Error: " << j.data << "\n";
+        st->jobs.pop_front();
+        st->nout++;
+        done = true;
+      }
+      out.flush();
+      if (done) st->cv.notify_all();
+      return st->eof && st->jobs.empty();
+    };
+
+    // stop the input thread: join it at the end, on errors it can be
+    // blocked in reading, detach it (it keeps the shared state and
+    // the input stream)
+    auto stop = [&](const bool ok){
+      {
+        std::lock_guard<std::mutex> lk(st->m);
+        st->stop = true;
+      }
+      st->cv.notify_all();
+      if (ok) reader.join();
+      else reader.detach();
+    };
+
+    // binary protocol: all requests are sent through a single connection
+    if (bin){
+      try {
+        std::map<uint32_t, size_t> ids; // request ID -> job
+        size_t nsent = 0; // number of processed input lines
+        while (1) {
+          {
+            std::lock_guard<std::mutex> lk(st->m);
+            for (; nsent < st->njobs(); nsent++){
+              auto & j = st->job(nsent);
+              if (j.state!=0) continue;
+              j.state = 1;
+              ids[bin->send("ask", j.dev, j.msg, ask_args)] = nsent;
+            }
+            if (print()) break;
+          }
+
+          // wait for a response or new input
+          struct pollfd fds[2] = {{bin->get_fd(), POLLIN, 0},
+                                  {st->wake[0], POLLIN, 0}};
+          if (poll(fds, 2, -1) < 0 && errno != EINTR)
+            throw Err() << "poll: " << strerror(errno);
+          if (fds[1].revents) st->drain();
+          if (!fds[0].revents) continue;
+
+          auto r = bin->recv();
+          if (!ids.count(r.id)) continue;
+          std::lock_guard<std::mutex> lk(st->m);
+          job_t & j = st->job(ids[r.id]);
+          ids.erase(r.id);
+          j.data = r.data;
+          j.state = r.err? 3:2;
+        }
+      }
+      catch (Err & e){
+        stop(false);
+        throw;
+      }
+      stop(true);
+      return;
+    }
+
+    CURLM *mh = curl_multi_init();
+    curl_multi_setopt(mh, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)max_conn);
+
+    std::map<std::string, std::queue<size_t> > queues;
+    size_t nqueued = 0; // number of processed input lines
+    std::vector<CURL*> pool; // free easy handles
+    std::set<std::string> busy; // devices with a request in progress
+    int nconn = 0;  // number of easy handles
+    int nrun = 0;   // number of running requests
+
+    while (1) {
+      {
+        std::lock_guard<std::mutex> lk(st->m);
+
+        // make per-device queues
+        for (; nqueued < st->njobs(); nqueued++){
+          auto & j = st->job(nqueued);
+          if (j.state==0) queues[j.dev].push(nqueued);
+        }
+
+        // start new requests: one per device
+        for (auto & q:queues){
+          if (q.second.empty() || busy.count(q.first)) continue;
+          if (pool.empty()){
+            if (nconn >= max_conn) break;
+            pool.push_back(curl_easy_init());
+            if (sock!="")
+              curl_easy_setopt(pool.back(), CURLOPT_UNIX_SOCKET_PATH, sock.c_str());
+            nconn++;
+          }
+          CURL *h = pool.back();
+          pool.pop_back();
+          size_t n = q.second.front();
+          q.second.pop();
+          job_t & j = st->job(n);
+          j.state = 1;
+          std::string url = make_url("ask", j.dev, j.msg);
+          curl_easy_setopt(h, CURLOPT_URL, url.c_str());
+          curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, write_cb);
+          curl_easy_setopt(h, CURLOPT_WRITEDATA, (void*) &j.data);
+          curl_easy_setopt(h, CURLOPT_PRIVATE, (void*) n);
+          curl_multi_add_handle(mh, h);
+          busy.insert(j.dev);
+          nrun++;
+        }
+
+        if (print()) break;
+      }
+
+      // do transfers, wait for them or for new input
+      int still_running;
+      curl_multi_perform(mh, &still_running);
+      struct curl_waitfd wfd = {st->wake[0], CURL_WAIT_POLLIN, 0};
+      curl_multi_wait(mh, &wfd, 1, 1000, NULL);
+      st->drain();
+
+      // process finished transfers
+      CURLMsg *m;
+      int nmsg;
+      while ((m = curl_multi_info_read(mh, &nmsg))){
+        if (m->msg != CURLMSG_DONE) continue;
+        CURL *h = m->easy_handle;
+        void *p;
+        curl_easy_getinfo(h, CURLINFO_PRIVATE, &p);
+        std::lock_guard<std::mutex> lk(st->m);
+        job_t & j = st->job((size_t)p);
+        long http_code = 0;
+        curl_easy_getinfo(h, CURLINFO_RESPONSE_CODE, &http_code);
+        if (m->data.result != CURLE_OK){
+          j.state = 3;
+          j.data = curl_easy_strerror(m->data.result);
+        }
+        else j.state = (http_code == 200) ? 2:3;
+        curl_multi_remove_handle(mh, h);
+        pool.push_back(h);
+        busy.erase(j.dev);
+        nrun--;
+      }
+    }
+    stop(true);
+    for (auto h:pool) curl_easy_cleanup(h);
+    curl_multi_cleanup(mh);
+  }
+
   // SPP interface to a single device.
   void use_dev(const std::string & dev,
                std::istream & in, std::ostream & out,
@@ -186,9 +497,38 @@ public:
     }
   }
 
+  // subscribe to changes of a message, print
+  // "<time>\t(val|err)\t<answer>" lines
+  void subscribe(const std::string & dev, const std::string & msg,
+                 const Opt & args, std::ostream & out){
+    get("subscribe", dev, msg, args);
+    while(1){
+      auto s = get("updates");
+      size_t b = 0, e;
+      while ((e = s.find('\n', b)) != std::string::npos){
+        auto t = s.find('\t', b);
+        if (t < e) out << s.substr(t+1, e-t) << std::flush;
+        b = e+1;
+      }
+    }
+  }
+
 };
 
 /*************************************************/
+// <arg>=<value> parameters starting from pars[n]
+Opt
+parse_args(const std::vector<std::string> & pars, const size_t n){
+  Opt args;
+  for (size_t i=n; i<pars.size(); i++){
+    auto p = pars[i].find('=');
+    if (p == std::string::npos)
+      throw Err() << "<arg>=<value> expected: " << pars[i];
+    args.put(pars[i].substr(0,p), pars[i].substr(p+1));
+  }
+  return args;
+}
+
 void
 check_par_count(const std::vector<std::string> & pars,
                 const int num) {
@@ -216,6 +556,12 @@ main(int argc, char ** argv) {
     std::string on("DEVCLI");
     options.add("server",  1,'s', on, "Server (default: localhost).");
     options.add("port",    1,'p', on, "Port (default: 8082).");
+    options.add("socket",  1,'u', on, "Connect to the server through a unix domain socket "
+                                      "(default: empty, use TCP connection).");
+    options.add("bin_port",1,'b', on, "Use binary protocol, connect to this TCP port "
+                                      "(default: 0, use HTTP).");
+    options.add("bin_socket",1,0, on, "Use binary protocol, connect to this unix domain socket "
+                                      "(default: empty, use HTTP).");
     options.add("via",     1,'v', on, "Connect to the server through a tunnel. "
                                       "Argument: name of the gateway.");
     options.add("via_cmd", 1,0  , on, "Specify command template for making the tunnel, with $L, $R, $H, "
@@ -224,6 +570,10 @@ main(int argc, char ** argv) {
     options.add("lock",    0,'l', on, "Lock the device (only for use_dev action).");
     options.add("name",    0,'n', on, "Set connection name (only for use_dev action). "
                                       "Default: \"device_c(<pid>)\". If empty, reset to server default name");
+    options.add("deadline",1,'d', on, "Deadline for ask requests, s. Requests which can not be "
+                                      "done in this time are dropped by the server (default: 0, no deadline).");
+    options.add("ts",      0,'t', on, "Print send and receive times before the answer (only for ask action).");
+    options.add("max_conn",1,'m', on, "Max number of parallel connections (only for batch action, default: 8).");
     options.add("help",    0,'h', on, "Print help message and exit.");
     options.add("pod",     0,0,   on, "Print help message in POD format and exit.");
 
@@ -237,7 +587,8 @@ main(int argc, char ** argv) {
 
     // read config file
     std::string cfgfile = "/etc/device2/device_c.cfg";
-    Opt optsf = read_conf(cfgfile, {"server", "port", "via", "via_cmd"});
+    Opt optsf = read_conf(cfgfile, {"server", "port", "socket", "via", "via_cmd",
+                                      "bin_port", "bin_socket"});
     opts.put_missing(optsf);
 
     // extract parameters
@@ -247,6 +598,14 @@ main(int argc, char ** argv) {
     auto name = opts.get("name",
       std::string("device_c(") + type_to_str(getpid())+")");
 
+    // unix socket
+    auto sock = opts.get("socket", "");
+    if (sock != ""){
+      if (opts.exists("via"))
+        throw Err() << "--socket and --via options can not be used together";
+      srv = "http://localhost";
+    }
+
     // create a tunnel if needed
     if (opts.exists("via")) srv = create_tunnel(opts);
 
@@ -254,17 +613,71 @@ main(int argc, char ** argv) {
     if (pars.size()==0) usage(options);
     auto & action = pars[0];
 
-    Downloader D(srv);
+    curl_global_init(CURL_GLOBAL_ALL);
+    Downloader D(srv, sock);
+    if (opts.get("deadline", 0.0) > 0)
+      D.set_ask_arg("deadline", opts.get("deadline"));
+
+    // binary protocol
+    auto bin_sock = opts.get("bin_socket", "");
+    int  bin_port = opts.get("bin_port", 0);
+    if (bin_sock != "" || bin_port != 0){
+      if (opts.exists("via"))
+        throw Err() << "binary protocol can not be used with --via option";
+      if (bin_sock != "")
+        D.use_bin(new BinClient(bin_sock), "bin:unix:" + bin_sock);
+      else
+        D.use_bin(new BinClient(server, bin_port),
+                  "bin:" + server + ":" + type_to_str(bin_port));
+    }
 
     if (action == "ask"){
       if (pars.size()<3)
         throw Err() << "not enough parameters for \"ask\" action";
       std::vector<std::string> args(pars.begin()+2, pars.end());
-      std::cout << D.get(action, pars[1], join_words(args)) << "\n";
+      Opt a;
+      if (opts.exists("ts")) a.put("ts", 1);
+      std::cout << D.get(action, pars[1], join_words(args), a) << "\n";
+      D.get("release", pars[1]);
+      return 0;
+    }
+
+    if (action == "txn"){
+      if (pars.size()<3)
+        throw Err() << "not enough parameters for \"txn\" action";
+      std::string msgs;
+      for (size_t i=2; i<pars.size(); i++)
+        msgs += (i>2? "\n":"") + pars[i];
+      std::cout << D.get(action, pars[1], msgs) << "\n";
       D.get("release", pars[1]);
       return 0;
     }
 
+    if (action == "group_ask"){
+      if (pars.size()<3)
+        throw Err() << "not enough parameters for \"group_ask\" action";
+      std::string msgs;
+      for (size_t i=2; i<pars.size(); i++)
+        msgs += (i>2? "\n":"") + pars[i];
+      std::cout << D.get(action, pars[1], msgs);
+      return 0;
+    }
+
+    if (action == "sweep"){
+      if (pars.size()<3)
+        throw Err() << "not enough parameters for \"sweep\" action";
+      std::cout << D.get(action, pars[1], pars[2], parse_args(pars, 3));
+      D.get("release", pars[1]);
+      return 0;
+    }
+
+    if (action == "history"){
+      if (pars.size()<2)
+        throw Err() << "not enough parameters for \"history\" action";
+      std::cout << D.get(action, pars[1], "", parse_args(pars, 2));
+      return 0;
+    }
+
     if (action == "use_dev"){
       check_par_count(pars, 2);
       D.use_dev(pars[1], std::cin, std::cout, opts.exists("lock"), name);
@@ -277,18 +690,61 @@ main(int argc, char ** argv) {
       return 0;
     }
 
+    if (action == "batch"){
+      if (pars.size()>2)
+        throw Err() << "unexpected parameter for \"batch\" action: " << pars[2];
+      int max_conn = opts.get("max_conn", 8);
+      if (max_conn<1) throw Err() << "bad --max_conn value: " << max_conn;
+      if (pars.size()==1 || pars[1]=="-"){
+        std::shared_ptr<std::istream> in(&std::cin, [](std::istream*){});
+        D.batch(in, std::cout, max_conn);
+      }
+      else {
+        std::shared_ptr<std::istream> in(new std::ifstream(pars[1]));
+        if (!*in) throw Err() << "can't open file: " << pars[1];
+        D.batch(in, std::cout, max_conn);
+      }
+      return 0;
+    }
+
     if (action == "list" || action == "devices") {
       check_par_count(pars, 1);
       std::cout << D.get(action);
       return 0;
     }
 
+    if (action == "locate"){
+      check_par_count(pars, 2);
+      auto node = D.get(action, pars[1]);
+      std::cout << (node==""? "local": node) << "\n";
+      return 0;
+    }
+
+    if (action == "peers") {
+      check_par_count(pars, 1);
+      std::cout << D.get(action);
+      return 0;
+    }
+
     if (action == "monitor") {
       check_par_count(pars, 2);
       D.monitor(pars[1], std::cout);
       return 0;
     }
 
+    if (action == "subscribe") {
+      if (pars.size()<3)
+        throw Err() << "not enough parameters for \"subscribe\" action";
+      D.subscribe(pars[1], pars[2], parse_args(pars, 3), std::cout);
+      return 0;
+    }
+
+    if (action == "subscriptions") {
+      check_par_count(pars, 1);
+      std::cout << D.get(action);
+      return 0;
+    }
+
     if (action == "reload") {
       check_par_count(pars, 1);
       std::cout << D.get(action) << "\n";
@@ -323,7 +779,10 @@ main(int argc, char ** argv) {
 
     if (action == "get_srv"){
       check_par_count(pars, 1);
-      std::cout << srv << "\n";
+      if (bin_sock!="") std::cout << "bin:unix:" << bin_sock << "\n";
+      else if (bin_port!=0) std::cout << "bin:" << server << ":" << bin_port << "\n";
+      else if (sock!="") std::cout << "unix:" << sock << "\n";
+      else std::cout << srv << "\n";
       return 0;
     }
 
@@ -1,6 +1,9 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <vector>
 #include <string>
+#include <memory>
 
 #include <csignal>
 #include <sys/types.h>
@@ -17,6 +20,7 @@
 #include "log/log.h"
 #include "dev_manager.h"
 #include "http_server.h"
+#include "bin_server.h"
 
 #define DEF_CFGFILE "/etc/device2/device_d.cfg"
 #define DEF_DEVFILE "/etc/device2/devices.cfg"
@@ -73,6 +77,17 @@ main(int argc, char ** argv) {
     options.add("devfile", 1,'D', "DEVSERV", "Device list file (default: " DEF_DEVFILE ").");
     options.add("addr",    1,'a', "DEVSERV", "IP address to listen. Use '*' to listen everywhere (default: " DEF_ADDR ").");
     options.add("port",    1,'p', "DEVSERV", "TCP port for connections (default: " STR(DEF_PORT) ").");
+    options.add("socket",  1,'s', "DEVSERV", "Unix domain socket for local connections "
+      "(default: empty, do not listen unix socket).");
+    options.add("socket_mode", 1,0, "DEVSERV", "Permissions of the unix domain socket, "
+      "octal value (default: 0, do not change).");
+    options.add("bin_port", 1,0, "DEVSERV", "TCP port for the binary protocol "
+      "(default: 0, do not use the binary protocol).");
+    options.add("bin_socket", 1,0, "DEVSERV", "Unix domain socket for the binary protocol "
+      "(default: empty, do not listen).");
+    options.add("peers", 1,0, "DEVSERV", "Other servers for forwarding requests to their devices: "
+                                         "space-separated list of <host>:<port> (binary protocol ports).");
+    options.add("peer_period", 1,0, "DEVSERV", "Period of updating device lists of other servers, s (default: 10).");
     options.add("dofork",  0,'f', "DEVSERV", "Do fork and run as a daemon.");
     options.add("stop",    0,'S', "DEVSERV", "Stop running daemon (found by pid-file).");
     options.add("reload",  0,'R', "DEVSERV", "Reload configuration of running daemon (found by pid-file).");
@@ -103,12 +118,24 @@ main(int argc, char ** argv) {
     // read config file
     std::string cfgfile = opts.get("cfgfile", DEF_CFGFILE);
     Opt optsf = read_conf(cfgfile,
-       {"addr", "port","logfile","pidfile","devfile","user","verbose"});
+       {"addr", "port","logfile","pidfile","devfile","user","verbose",
+        "socket", "socket_mode", "bin_port", "bin_socket", "peers", "peer_period"});
     opts.put_missing(optsf);
 
     // extract parameters
     std::string addr = opts.get("addr", DEF_ADDR);
     int port    = opts.get("port", DEF_PORT);
+    std::string sockpath = opts.get("socket", "");
+    int socket_mode = strtol(opts.get("socket_mode", "0").c_str(), NULL, 8);
+    int bin_port = opts.get("bin_port", 0);
+    std::string bin_sockpath = opts.get("bin_socket", "");
+    std::vector<std::string> peers;
+    {
+      std::istringstream ss(opts.get("peers", ""));
+      std::string p;
+      while (ss >> p) peers.push_back(p);
+    }
+    double peer_period = opts.get("peer_period", 10.0);
     bool dofork = opts.exists("dofork");
     bool stop   = opts.exists("stop");
     bool reload = opts.exists("reload");
@@ -237,10 +264,31 @@ main(int argc, char ** argv) {
     // create device manager
     DevManager dm(devfile);
     dmp = &dm; // pointer for ReloadFunc
+    if (peers.size()){
+      dm.set_peers(peers, peer_period);
+      Log(1) << "Peers: " << opts.get("peers");
+    }
 
-    HTTP_Server srv(addr, port, test, &dm);
+    auto srv = HTTP_Server::tcp(addr, port, &dm, test);
     Log(1) << "HTTP server is running at "
       << addr << ":" << port;
+
+    std::unique_ptr<HTTP_Server> srv_local;
+    if (sockpath != ""){
+      srv_local = HTTP_Server::unix_socket(sockpath, socket_mode, &dm, test);
+      Log(1) << "HTTP server is running at " << sockpath;
+    }
+
+    std::unique_ptr<BinServer> bsrv, bsrv_local;
+    if (bin_port != 0){
+      bsrv = BinServer::tcp(addr, bin_port, &dm, test);
+      Log(1) << "Binary protocol server is running at "
+        << addr << ":" << bin_port;
+    }
+    if (bin_sockpath != ""){
+      bsrv_local = BinServer::unix_socket(bin_sockpath, socket_mode, &dm, test);
+      Log(1) << "Binary protocol server is running at " << bin_sockpath;
+    }
     if (test) Log(1) << "TESTING MODE";
 
     // set up signals
@@ -0,0 +1,355 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "getopt/getopt.h"
+#include "getopt/help_printer.h"
+#include "read_words/read_words.h"
+#include "err/err.h"
+#include "log/log.h"
+#include "dev_manager.h"
+#include "bin_server.h"
+#include "bin_client.h"
+#include "replay_log.h"
+
+/*************************************************/
+// print help message
+void usage(const GetOptSet & options, bool pod=false){
+  HelpPrinter pr(pod, options, "device_replay");
+  pr.name("replay recorded device conversations through device drivers");
+  pr.usage("[<options>] <log file> [<driver> [<driver options>]]");
+
+  pr.head(1, "Description:");
+  pr.par("Program reads a device log (as returned by log_get action "
+         "or printed by device_c monitor, optionally with timestamps) "
+         "or a device_d log written with verbosity level 3, and sends all "
+         "recorded messages to a device through the server (as in device_d, "
+         "using the binary protocol on a temporary unix socket), measuring "
+         "time spent on each message. If no driver is given (or the driver is `net` without -addr "
+         "parameter), a simulated network endpoint is started, which "
+         "answers with the recorded answers. Recorded errors are skipped.");
+  pr.par("Use '-' as log file name to read from stdin.");
+
+  pr.head(1, "Options:");
+  pr.opts({"REPLAY"});
+  pr.par("Homepage, documentation: https://github.com/slazav/device2");
+  throw Err();
+}
+
+typedef std::chrono::steady_clock clk;
+
+// time interval in microseconds
+double
+us(const clk::duration & d){
+  return std::chrono::duration<double, std::micro>(d).count();}
+
+/*************************************************/
+// Simulated network endpoint: listen on a local TCP port,
+// read messages (terminated by \n) and send recorded answers
+// exactly as they were logged (nothing for empty answers).
+// The driver can reconnect, answers are continued then.
+
+class ReplayEndpoint {
+  int lsock, sock;
+  bool stop;
+  std::vector<std::string> answers;
+  std::mutex mtx; // for sock and stop
+  std::thread thr;
+
+  void run(){
+    size_t n = 0;
+    while (1){
+      int s = accept(lsock, NULL, NULL);
+      if (s<0 && errno == EINTR) continue;
+      {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (stop) { if (s>=0) ::close(s); return; }
+        if (s<0) continue;
+        sock = s;
+      }
+      std::string buf;
+      char b[4096];
+      bool ok = true;
+      while (ok){
+        auto res = ::recv(s, b, sizeof(b), 0);
+        if (res<=0) break;
+        buf.append(b, res);
+        size_t p;
+        while (ok && (p=buf.find('\n')) != std::string::npos){
+          buf.erase(0, p+1);
+          if (n>=answers.size()) continue;
+          auto const & a = answers[n++];
+          if (a.size() && ::send(s, a.data(), a.size(), MSG_NOSIGNAL) < 0)
+            ok = false;
+        }
+      }
+      std::lock_guard<std::mutex> lk(mtx);
+      sock = -1;
+      ::close(s);
+    }
+  }
+
+public:
+  ReplayEndpoint(const std::vector<std::string> & answers):
+      sock(-1), stop(false), answers(answers){
+    lsock = socket(AF_INET, SOCK_STREAM, 0);
+    if (lsock<0) throw Err()
+      << "replay endpoint: can't create socket: " << strerror(errno);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(lsock, (struct sockaddr *)&addr, sizeof(addr))<0 ||
+        listen(lsock, 4)<0) throw Err()
+      << "replay endpoint: can't listen: " << strerror(errno);
+    thr = std::thread(&ReplayEndpoint::run, this);
+  }
+
+  // stop the serving thread, close the listening socket
+  // after it is finished
+  ~ReplayEndpoint(){
+    {
+      std::lock_guard<std::mutex> lk(mtx);
+      stop = true;
+      if (sock>=0) shutdown(sock, SHUT_RDWR);
+    }
+    shutdown(lsock, SHUT_RDWR);
+    thr.join();
+    ::close(lsock);
+  }
+
+  int port() const {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(lsock, (struct sockaddr *)&addr, &len)<0) throw Err()
+      << "replay endpoint: getsockname: " << strerror(errno);
+    return ntohs(addr.sin_port);
+  }
+};
+
+/*************************************************/
+// Temporary files: device configuration and server socket,
+// removed in the destructor.
+
+struct ReplayFiles {
+  std::string conf, sock;
+
+  ReplayFiles(const std::string & conf_line){
+    char tmp[] = "/tmp/device_replay.XXXXXX";
+    int fd = mkstemp(tmp);
+    if (fd<0) throw Err() << "can't create temporary file: " << strerror(errno);
+    conf = tmp;
+    sock = conf + ".sock";
+    bool ok = ::write(fd, conf_line.data(), conf_line.size()) ==
+              (ssize_t)conf_line.size();
+    ::close(fd);
+    if (!ok) { unlink(conf.c_str()); throw Err()
+      << "can't write temporary file: " << conf; }
+  }
+
+  ~ReplayFiles(){
+    unlink(conf.c_str());
+    unlink(sock.c_str());
+  }
+};
+
+/*************************************************/
+// print statistics for a list of values
+void
+print_stat(std::ostream & out, const std::string & name, std::vector<double> v){
+  if (v.size()==0) return;
+  std::sort(v.begin(), v.end());
+  double sum = 0;
+  for (auto const & x:v) sum+=x;
+  auto perc = [&v](double p){ return v[std::min(v.size()-1, size_t(p*v.size()))]; };
+  out << std::fixed << std::setprecision(1)
+      << name << ", us: min " << v.front()
+      << ", mean " << sum/v.size()
+      << ", median " << perc(0.5)
+      << ", p90 " << perc(0.9)
+      << ", p99 " << perc(0.99)
+      << ", max " << v.back() << "\n";
+}
+
+/*************************************************/
+// main function.
+
+int
+main(int argc, char ** argv) {
+
+  try {
+    GetOptSet options;
+    std::string on("REPLAY");
+    options.add("speed",   1,'s', on, "Replay speed relative to the original timing. "
+                                      "Timestamps should be present in the log. "
+                                      "0 - as fast as possible (default: 0).");
+    options.add("dev",     1,'d', on, "Use only messages for this device (for server logs).");
+    options.add("repeat",  1,'r', on, "Replay the log N times (default: 1).");
+    options.add("verbose", 0,'v', on, "Print time spent on every message.");
+    options.add("help",    0,'h', on, "Print help message and exit.");
+    options.add("pod",     0,0,   on, "Print help message in POD format and exit.");
+
+    Opt opts = parse_options(&argc, &argv, options, {}, 0);
+    std::vector<std::string> args(argv, argv+argc);
+
+    if (opts.exists("help")) usage(options);
+    if (opts.exists("pod"))  usage(options,true);
+    if (args.size() < 1) usage(options);
+
+    double speed = opts.get("speed", 0.0);
+    int repeat   = opts.get("repeat", 1);
+    bool verb    = opts.exists("verbose");
+
+    // read the log
+    std::vector<ReplayRec> recs;
+    if (args[0] == "-") {
+      recs = read_replay_log(std::cin, opts.get("dev", ""));
+    }
+    else {
+      std::ifstream f(args[0]);
+      if (!f) throw Err() << "can't open file: " << args[0];
+      recs = read_replay_log(f, opts.get("dev", ""));
+    }
+
+    // skip errors
+    size_t nerr = 0;
+    std::vector<ReplayRec> recs1;
+    for (auto const & r:recs){
+      if (r.err) nerr++;
+      else recs1.push_back(r);
+    }
+    recs.swap(recs1);
+    if (recs.size()==0) throw Err() << "no messages found in the log";
+
+    // driver and its options
+    std::string drv = args.size()>1 ? args[1] : "net";
+    Opt dopts;
+    for (size_t i=2; i<args.size(); i+=2){
+      if (args[i].size()<2 || args[i][0]!='-' || i+1>=args.size()) throw Err()
+        << "driver options should contain -<name> <value> pairs: " << args[i];
+      dopts.put(args[i].substr(1), unquote_words(args[i+1]));
+    }
+
+    // simulated endpoint
+    std::unique_ptr<ReplayEndpoint> ep;
+    if (drv == "net" && !dopts.exists("addr")){
+      std::vector<std::string> answers;
+      size_t maxlen = 0;
+      for (int i=0; i<repeat; i++)
+        for (auto const & r:recs) {
+          answers.push_back(r.ans);
+          maxlen = std::max(maxlen, r.ans.size());
+        }
+      ep.reset(new ReplayEndpoint(answers));
+      dopts.put("addr", "127.0.0.1");
+      dopts.put("port", ep->port());
+      // Answers are sent as they were logged, do not trim them.
+      // Nothing is sent for empty answers (usually commands without
+      // a question mark), do not read them then.
+      bool empty = false;
+      for (auto const & r:recs) if (r.ans.empty()) empty = true;
+      dopts.put_missing("read_cond", empty? "qmark1w":"always");
+      dopts.put_missing("trim_str", "");
+      dopts.put_missing("bufsize", std::max(maxlen, (size_t)4096));
+      dopts.put_missing("delay", 0);
+    }
+
+    // The device is served by DevManager and the binary protocol server
+    // on a temporary unix socket, messages are sent by the client: the
+    // same path as for requests to device_d.
+    Log::set_log_level(0);
+    std::vector<std::string> conf = {"replay", drv};
+    for (auto const & o:dopts){
+      conf.push_back("-" + o.first);
+      conf.push_back(o.second);
+    }
+    ReplayFiles files(join_words(conf) + "\n");
+    DevManager dm(files.conf);
+    if (dm.size()==0) dm.read_conf(files.conf); // throw the configuration error
+    auto srv = BinServer::unix_socket(files.sock, 0, &dm, false);
+    BinClient cl(files.sock);
+    cl.get("use", "replay"); // open the device before measurements
+
+    // send and receive times of the driver are used to get the overhead
+    Opt ask_opts;
+    ask_opts.put("ts", 1);
+
+    std::vector<double> lat, ovh;
+    size_t nmis = 0, nfail = 0, n = 0;
+    auto t0 = clk::now();
+    for (int i=0; i<repeat; i++){
+      auto t0r = clk::now();
+      for (auto const & r:recs){
+
+        // keep original timing
+        if (speed>0 && r.t>=0 && recs[0].t>=0){
+          auto dt = std::chrono::duration<double>((r.t - recs[0].t)/speed);
+          std::this_thread::sleep_until(t0r +
+            std::chrono::duration_cast<clk::duration>(dt));
+        }
+
+        auto t1 = clk::now();
+        std::string ans;
+        bool fail = false;
+        double ex = -1; // time of the exchange with the device, us
+        try {
+          ans = cl.get("ask", "replay", r.msg, ask_opts);
+          // first line: send and receive times (realtime, monotonic)
+          auto p = ans.find('\n');
+          std::istringstream ss(ans.substr(0, p));
+          double s1(0), s2(0), r1(0), r2(0);
+          ss >> s1 >> s2 >> r1 >> r2;
+          if (s2>0 && r2>=s2) ex = (r2-s2)*1e6;
+          ans = p==std::string::npos ? "" : ans.substr(p+1);
+        }
+        catch (Err & e) { ans = e.str(); fail = true; }
+        auto t2 = clk::now();
+
+        double l = us(t2-t1);
+        lat.push_back(l);
+        if (ex>=0) ovh.push_back(l - ex);
+        if (fail) nfail++;
+        else if (ans != r.ans) nmis++;
+        n++;
+
+        if (verb){
+          std::cout << std::fixed << std::setprecision(1) << l << " ";
+          if (ex>=0) std::cout << l - ex;
+          else std::cout << "-";
+          std::cout << " " << r.msg << (fail? " -- error: " + ans : "") << "\n";
+        }
+      }
+    }
+    double tt = std::chrono::duration<double>(clk::now()-t0).count();
+
+    std::cout << "messages: " << n << " (" << nerr << " recorded errors skipped)\n"
+              << "driver errors: " << nfail << "\n"
+              << "mismatched answers: " << nmis << "\n";
+    print_stat(std::cout, "latency", lat);
+    print_stat(std::cout, "overhead", ovh);
+    std::cout << std::fixed << std::setprecision(3)
+              << "total time: " << tt << " s, "
+              << std::setprecision(1) << n/tt << " messages/s\n";
+  }
+  catch (Err e){
+    if (e.str()!="") std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
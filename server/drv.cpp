@@ -15,6 +15,11 @@
 #include "drv_serial_jds6600.h"
 #include "drv_gpib.h"
 #include "drv_vxi.h"
+#include "drv_remote.h"
+
+thread_local Driver::Times Driver::times;
+thread_local Driver::clock::time_point Driver::deadline =
+  Driver::clock::time_point::max();
 
 std::shared_ptr<Driver>
 Driver::create(const std::string & name, const Opt & args){
@@ -61,6 +66,9 @@ Driver::create(const std::string & name, const Opt & args){
   if (name == "serial_jds6600")
      return std::shared_ptr<Driver>(new Driver_serial_jds6600(args));
 
+  if (name == "remote")
+     return std::shared_ptr<Driver>(new Driver_remote(args));
+
 #ifdef USE_GPIB
   if (name == "gpib")
      return std::shared_ptr<Driver>(new Driver_gpib(args));
@@ -73,3 +81,11 @@ Driver::create(const std::string & name, const Opt & args){
 
   throw Err() << "unknown driver: " << name;
 }
+
+double
+Driver::get_timeout(const double t) const {
+  if (deadline == clock::time_point::max()) return t;
+  double r = std::chrono::duration<double>(deadline - clock::now()).count();
+  if (r <= 0) throw Err() << "request deadline expired";
+  return (t<=0 || r<t)? r:t;
+}
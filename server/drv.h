@@ -3,12 +3,56 @@
 
 #include <string>
 #include <memory>
+#include <chrono>
+#include <time.h>
 #include "opt/opt.h"
 
+// Error codes (Err::code()) for failures of the connection with the
+// device: it can not be reached or it does not answer. Only these errors
+// are counted by the circuit breaker (see Device). Errors reported by
+// the device and expired request deadlines have default code.
+#define DRV_CONN_LOST 1 // connection is broken (request can be repeated)
+#define DRV_CONN_ERR  2 // other connection errors and timeouts
+
 /*************************************************/
 // base class
 
 class Driver {
+public:
+  typedef std::chrono::steady_clock clock;
+
+  // Time stamp (CLOCK_REALTIME and CLOCK_MONOTONIC), zero if not set.
+  struct TimeStamp {
+    struct timespec rt, mono;
+    TimeStamp(): rt{0,0}, mono{0,0} {}
+    void set() {
+      clock_gettime(CLOCK_REALTIME, &rt);
+      clock_gettime(CLOCK_MONOTONIC, &mono);
+    }
+    bool empty() const {return rt.tv_sec==0 && rt.tv_nsec==0;}
+  };
+
+  // Times of the current request: just before sending the message
+  // and just after receiving the answer. Set by drivers in write()/read(),
+  // reset by Device before the request. Per thread: requests to
+  // parallel drivers are running in different threads.
+  struct Times {TimeStamp send, recv;};
+  static thread_local Times times;
+
+protected:
+  // Deadline of the current request (set by Device::ask),
+  // clock::time_point::max() if there is no deadline. Per thread,
+  // as times.
+  static thread_local clock::time_point deadline;
+
+  // Timeout for a read operation, s: driver timeout `t` (<=0 for no
+  // timeout) limited by the request deadline. Return value <=0 means
+  // no timeout. Throw Err if the deadline has expired.
+  double get_timeout(const double t) const;
+
+  // Has the request deadline expired?
+  bool expired() const {return clock::now() >= deadline;}
+
 public:
   // Create and return a device driver (static function).
   // Parameter `args` contains parameters from the configuration file.
@@ -25,6 +69,14 @@ public:
   // Send message to the device, get answer
   virtual std::string ask(const std::string & msg) = 0;
 
+  // Set deadline for the following operations.
+  // Drivers which support it use get_timeout() for reading.
+  void set_deadline(const clock::time_point & t) {deadline = t;}
+
+  // Can the driver process requests from different threads in
+  // parallel? If not, Device sends requests one by one.
+  virtual bool parallel() const {return false;}
+
 };
 
 #endif
@@ -150,9 +150,10 @@ std::string
 Driver_gpib::read() {
   char buf[bufsize];
   ibrd(dh, buf, sizeof(buf));
-  if (ibsta & ERR) throw Err() << errpref
+  if (ibsta & ERR) throw Err(DRV_CONN_ERR) << errpref
     << "read error: " << error_text(iberr);
 
+  times.recv.set();
   auto ret = std::string(buf, buf+ibcntl);
 
   trim_str(ret,trim); // -trim option
@@ -164,8 +165,9 @@ Driver_gpib::write(const std::string & msg) {
   std::string m = msg;
   if (add.size()>0) m+=add;
 
+  times.send.set();
   auto ret = ibwrt(dh, m.data(), m.size());
-  if (ibsta & ERR) throw Err() << errpref
+  if (ibsta & ERR) throw Err(DRV_CONN_ERR) << errpref
     << "write error: " << error_text(iberr);
 
   if (delay>0) usleep(delay*1e6);
@@ -0,0 +1,21 @@
+#include "drv_io.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/select.h>
+
+ssize_t
+io_read(const int fd, void * buf, const size_t n, const double timeout){
+  if (timeout > 0){
+    struct timespec timeout_s;
+    timeout_s.tv_sec = int(timeout);
+    timeout_s.tv_nsec = (timeout - int(timeout))*1e9;
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(fd, &set);
+    auto res = pselect(fd+1, &set, NULL, NULL, &timeout_s, NULL);
+    if (res < 0) return -1;
+    if (res == 0) { errno = ETIME; return -1; }
+  }
+  return ::read(fd, buf, n);
+}
@@ -0,0 +1,12 @@
+#ifndef DRV_IO_H
+#define DRV_IO_H
+
+#include <sys/types.h>
+
+// Wait for data up to `timeout` seconds and read it (used by serial
+// and net drivers). If timeout<=0 just read the file descriptor.
+// Return number of bytes, 0 on EOF, -1 on errors with errno set
+// (ETIME if no data arrived before the timeout).
+ssize_t io_read(const int fd, void * buf, const size_t n, const double timeout);
+
+#endif
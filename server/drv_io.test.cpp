@@ -0,0 +1,79 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cassert>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "drv_io.h"
+#include "err/assert_err.h"
+
+using namespace std;
+
+int
+main(){
+  try{
+    typedef std::chrono::steady_clock clock;
+    int sv[2];
+    assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    char buf[100];
+
+    // data is available
+    assert_eq(write(sv[0], "abc", 3), 3);
+    assert_eq(io_read(sv[1], buf, sizeof(buf), 1), 3);
+    assert_eq(string(buf, 3), "abc");
+
+    // timeout
+    auto t0 = clock::now();
+    assert_eq(io_read(sv[1], buf, sizeof(buf), 0.1), -1);
+    assert_eq(errno, ETIME);
+    auto dt = std::chrono::duration<double>(clock::now()-t0).count();
+    assert(dt >= 0.09 && dt < 0.5);
+
+    // data arrives while waiting; parallel reads from
+    // different sockets
+    {
+      int sv2[2];
+      assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv2), 0);
+      thread t([&]{
+        usleep(50000);
+        assert_eq(write(sv2[0], "x", 1), 1);
+        usleep(50000);
+        assert_eq(write(sv[0], "de", 2), 2);
+      });
+      char buf2[100];
+      ssize_t r2;
+      thread t2([&]{ r2 = io_read(sv2[1], buf2, sizeof(buf2), 1); });
+      assert_eq(io_read(sv[1], buf, sizeof(buf), 1), 2);
+      assert_eq(string(buf, 2), "de");
+      t.join();
+      t2.join();
+      assert_eq(r2, 1);
+      assert_eq(buf2[0], 'x');
+      close(sv2[0]);
+      close(sv2[1]);
+    }
+
+    // no timeout
+    assert_eq(write(sv[0], "f", 1), 1);
+    assert_eq(io_read(sv[1], buf, sizeof(buf), 0), 1);
+
+    // EOF
+    close(sv[0]);
+    assert_eq(io_read(sv[1], buf, sizeof(buf), 1), 0);
+    close(sv[1]);
+
+    // errors
+    assert_eq(io_read(sv[1], buf, sizeof(buf), 1), -1);
+    assert_eq(errno, EBADF);
+  }
+  catch (Err e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
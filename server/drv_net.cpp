@@ -1,66 +1,120 @@
 #include "drv_net.h"
 #include "drv_utils.h"
+#include "drv_io.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <cstring>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <vector>
 #include <netdb.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 
 // based on the example in
 // https://beej.us/guide/bgnet/html//index.html#a-simple-stream-client
 
-Driver_net::Driver_net(const Opt & opts) {
-  opts.check_unknown({"addr","port","timeout","bufsize","delay",
-    "open_delay", "errpref", "idn", "read_cond", "add_str", "trim_str"});
-  int res;
+/*************************************************/
+// Resolver cache, shared by all net drivers: "addr:port" -> addresses.
 
-  //prefix for error messages
-  errpref = opts.get("errpref", "Driver_net: ");
+namespace {
 
-  // address and port (mandatory settings)
-  std::string addr = opts.get("addr", "");
-  if (addr == "") throw Err() << errpref
-    << "Parameter -addr is empty or missing";
+struct NetAddr {
+  int family;
+  sockaddr_storage sa;
+  socklen_t len;
+};
 
-  std::string port = opts.get("port", "5025");
+struct ResolvEntry {
+  std::vector<NetAddr> addrs;
+  Driver::clock::time_point exp;
+};
 
-  errpref += addr + ":" + port + ": ";
+std::mutex resolv_mutex;
+std::map<std::string, ResolvEntry> resolv_cache;
+
+std::vector<NetAddr>
+resolve(const std::string & addr, const std::string & port,
+        const double ttl, const std::string & errpref){
+  auto key = addr + ":" + port;
+  auto now = Driver::clock::now();
+  if (ttl>0){
+    std::lock_guard<std::mutex> lk(resolv_mutex);
+    auto i = resolv_cache.find(key);
+    if (i!=resolv_cache.end() && i->second.exp > now) return i->second.addrs;
+  }
 
   // fill hints structure and do getaddrinfo
-  struct addrinfo hints, *servinfo, *p;
+  struct addrinfo hints, *servinfo;
   memset(&hints, 0, sizeof(hints));
   hints.ai_family = AF_UNSPEC;
   hints.ai_socktype = SOCK_STREAM;
-  res = getaddrinfo(addr.c_str(), port.c_str(), &hints, &servinfo);
+  int res = getaddrinfo(addr.c_str(), port.c_str(), &hints, &servinfo);
   if (res != 0) throw Err() << errpref
     << "getaddrinfo: " << gai_strerror(res);
 
-  // open_delay parameter
-  double open_delay = opts.get("open_delay", 0.0);
-  if (open_delay>0) usleep(open_delay*1e6);
-
-  // loop through all the results and connect to the first we can
-  int e;
-  for(p = servinfo; p != NULL; p = p->ai_next) {
-    sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-    if (sockfd == -1) {e = errno; continue; }
-    res = connect(sockfd, p->ai_addr, p->ai_addrlen);
-    if (res == -1) {e = errno; continue; }
-    break;
-  }
-  if (p == NULL) {
-    freeaddrinfo(servinfo);
-    throw Err() << errpref
-      << "can't connect: " << strerror(e);
+  ResolvEntry e;
+  for (auto p = servinfo; p != NULL; p = p->ai_next) {
+    NetAddr a;
+    a.family = p->ai_family;
+    a.len = p->ai_addrlen;
+    memcpy(&a.sa, p->ai_addr, p->ai_addrlen);
+    e.addrs.push_back(a);
   }
   freeaddrinfo(servinfo);
 
+  if (ttl>0){
+    e.exp = now + std::chrono::duration_cast<Driver::clock::duration>(
+                    std::chrono::duration<double>(ttl));
+    std::lock_guard<std::mutex> lk(resolv_mutex);
+    resolv_cache[key] = e;
+  }
+  return e.addrs;
+}
+
+// remove addresses from the cache (if they do not work)
+void
+resolve_forget(const std::string & addr, const std::string & port){
+  std::lock_guard<std::mutex> lk(resolv_mutex);
+  resolv_cache.erase(addr + ":" + port);
+}
+
+}
+
+/*************************************************/
+
+Driver_net::Driver_net(const Opt & opts) {
+  opts.check_unknown({"addr","port","timeout","bufsize","delay",
+    "open_delay", "errpref", "idn", "read_cond", "add_str", "trim_str",
+    "conn_timeout", "dns_ttl", "nodelay", "keepalive", "retry"});
+
+  //prefix for error messages
+  errpref = opts.get("errpref", "Driver_net: ");
+
+  // address and port (mandatory settings)
+  addr = opts.get("addr", "");
+  if (addr == "") throw Err() << errpref
+    << "Parameter -addr is empty or missing";
+
+  port = opts.get("port", "5025");
+
+  errpref += addr + ":" + port + ": ";
+  open_delay = opts.get("open_delay", 0.0);
+  conn_timeout = opts.get("conn_timeout", 5.0);
+  dns_ttl   = opts.get("dns_ttl", 60.0);
+  nodelay   = opts.get("nodelay", true);
+  keepalive = opts.get("keepalive", 60);
+  retry     = opts.get("retry", true);
+
   bufsize = opts.get("bufsize", 4096);
   timeout = opts.get("timeout", 5.0);
   delay   = opts.get("delay",   0.0);
@@ -68,38 +122,123 @@ Driver_net::Driver_net(const Opt & opts) {
   trim    = opts.get("trim_str", "\n");
   idn     = opts.get("idn", "");
   read_cond = str_to_read_cond(opts.get("read_cond", "qmark1w"));
+
+  sockfd = -1;
+  open_conn();
 }
 
 Driver_net::~Driver_net() {
+  if (sockfd>=0) ::close(sockfd);
+}
+
+void
+Driver_net::open_conn() {
+  auto addrs = resolve(addr, port, dns_ttl, errpref);
+
+  // open_delay parameter
+  if (open_delay>0) usleep(open_delay*1e6);
+
+  // Start non-blocking connections to all addresses,
+  // use the first successful one.
+  std::vector<struct pollfd> fds;
+  int fd = -1, e = 0;
+
+  // close all sockets which are not used on any exit
+  struct FdGuard {
+    std::vector<struct pollfd> & fds;
+    int & fd;
+    ~FdGuard(){
+      for (auto const & p: fds) ::close(p.fd);
+      if (fd>=0) ::close(fd);
+    }
+  } guard{fds, fd};
+
+  for (auto const & a: addrs) {
+    int s = socket(a.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s == -1) {e = errno; continue; }
+    if (connect(s, (const sockaddr *)&a.sa, a.len) == 0) {fd = s; break;}
+    if (errno != EINPROGRESS) {e = errno; ::close(s); continue; }
+    struct pollfd p = {s, POLLOUT, 0};
+    fds.push_back(p);
+  }
+
+  // wait for connections (limited by the request deadline),
+  // no timeout if conn_timeout<=0
+  double t = fds.size()>0 ? get_timeout(conn_timeout) : 0;
+  auto t_end = clock::now() + std::chrono::duration_cast<clock::duration>(
+                                std::chrono::duration<double>(t));
+  while (fd<0 && fds.size()>0) {
+    int ms = -1;
+    if (t>0) {
+      double dt = std::chrono::duration<double>(t_end - clock::now()).count();
+      if (dt<=0) {e = ETIMEDOUT; break;}
+      ms = int(dt*1000)+1;
+    }
+    int res = poll(fds.data(), fds.size(), ms);
+    if (res < 0 && errno == EINTR) continue;
+    if (res < 0) {e = errno; break;}
+    for (auto i = fds.begin(); i != fds.end();) {
+      if (i->revents == 0) {++i; continue;}
+      int err = 0;
+      socklen_t len = sizeof(err);
+      getsockopt(i->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      if (err == 0 && fd<0) {fd = i->fd; i = fds.erase(i); continue;}
+      if (err) e = err;
+      ::close(i->fd);
+      i = fds.erase(i);
+    }
+  }
+
+  if (fd<0) {
+    resolve_forget(addr, port);
+    throw Err(DRV_CONN_ERR) << errpref << "can't connect: " << strerror(e);
+  }
+
+  // blocking mode, socket options
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  int one = 1;
+  if (nodelay) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (keepalive>0) {
+    int intvl = std::max(1, keepalive/3), cnt = 3;
+    setsockopt(fd, SOL_SOCKET,  SO_KEEPALIVE,  &one, sizeof(one));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE,  &keepalive, sizeof(keepalive));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof(intvl));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT,   &cnt, sizeof(cnt));
+  }
+  sockfd = fd;
+  fd = -1;
+}
+
+void
+Driver_net::conn_lost(const std::string & msg, int err) {
   ::close(sockfd);
+  sockfd = -1;
+  if (err) throw Err(DRV_CONN_LOST) << errpref << msg << ": " << strerror(err);
+  throw Err(DRV_CONN_LOST) << errpref << msg;
 }
 
 std::string
 Driver_net::read() {
   char buf[bufsize];
+  if (sockfd<0) throw Err(DRV_CONN_ERR) << errpref << "connection is closed";
 
-  // Reading with timeout.
-  if (timeout > 0) {
-    // Prepare timeout structure and fd_set
-    struct timespec timeout_s;
-    timeout_s.tv_sec = int(timeout);
-    timeout_s.tv_nsec = (timeout - int(timeout))*1e9;
-    fd_set set;
-    FD_ZERO(&set); // clear the set
-    FD_SET(sockfd, &set);
-
-    // Wait for data.
-    auto res = pselect(sockfd+1, &set, NULL, NULL, &timeout_s, NULL);
-    if (res == -1) throw Err() << errpref << "select error: " << strerror(errno);
-    if (res == 0)  throw Err() << errpref << "read timeout";
+  // Reading with timeout (limited by the request deadline).
+  auto res = io_read(sockfd, buf, sizeof(buf), get_timeout(timeout));
+  if (res<0 && errno == ETIME){
+    // Request is abandoned because of the deadline. Its answer can
+    // arrive later and mix with following answers. Close the
+    // connection, it will be reopened on the next write.
+    if (expired()){
+      ::close(sockfd);
+      sockfd = -1;
+      throw Err() << errpref << "request deadline expired";
+    }
+    throw Err(DRV_CONN_ERR) << errpref << "read timeout";
   }
+  if (res<0) conn_lost("read error", errno);
+  if (res==0) conn_lost("connection closed by the device");
 
-  // Read data
-  int fl=0;
-  auto res = ::recv(sockfd, buf, sizeof(buf), fl);
-  if (res<0) throw Err() << errpref
-    << "read error: " << strerror(errno);
-
+  times.recv.set();
   auto ret = std::string(buf, buf+res);
 
   trim_str(ret,trim); // -trim option
@@ -112,10 +251,38 @@ Driver_net::write(const std::string & msg) {
   std::string m = msg;
   if (add.size()>0) m+=add;
 
+  // Check if the connection was closed by the device while it was idle
+  // (the socket is readable and has no data). Unread data from
+  // previous requests is left as is.
+  if (sockfd>=0) {
+    struct pollfd p = {sockfd, POLLIN, 0};
+    char c;
+    if (poll(&p, 1, 0) == 1 &&
+        ::recv(sockfd, &c, 1, MSG_PEEK | MSG_DONTWAIT) <= 0) {
+      ::close(sockfd);
+      sockfd = -1;
+    }
+  }
+
+  // reopen connection closed after an abandoned request
+  // or a connection error
+  if (sockfd<0) open_conn();
+
   int fl = MSG_NOSIGNAL;
-  ssize_t ret = ::send(sockfd, m.data(), m.size(), fl);
-  if (ret<0) throw Err() << errpref
-    << "write error: " << strerror(errno);
+  size_t n = 0;
+  times.send.set();
+  while (n < m.size()) {
+    ssize_t ret = ::send(sockfd, m.data()+n, m.size()-n, fl);
+    if (ret<0 && errno == EINTR) continue;
+    if (ret<0 && n>0) { // part of the message is sent, do not repeat it
+      auto e = errno;
+      ::close(sockfd);
+      sockfd = -1;
+      throw Err(DRV_CONN_ERR) << errpref << "write error: " << strerror(e);
+    }
+    if (ret<0) conn_lost("write error", errno);
+    n += ret;
+  }
   if (delay>0) usleep(delay*1e6);
 }
 
@@ -124,10 +291,22 @@ Driver_net::ask(const std::string & msg) {
 
   if (idn.size() && strcasecmp(msg.c_str(),"*idn?")==0) return idn;
 
-  write(msg);
-
   // if there is no '?' in the message no answer is needed.
-  if (!check_read_cond(msg, read_cond)) return std::string();
+  bool rd = check_read_cond(msg, read_cond);
 
-  return read();
+  // If the connection is broken, reconnect and repeat the request once
+  // (only if the message was not sent, or it is a query: commands
+  // should not be executed twice).
+  bool sent = false;
+  try {
+    write(msg);
+    sent = true;
+    return rd ? read() : std::string();
+  }
+  catch (Err & e) {
+    if (!retry || e.code() != DRV_CONN_LOST) throw;
+    if (sent && msg.find('?') == std::string::npos) throw;
+  }
+  write(msg);
+  return rd ? read() : std::string();
 }
@@ -23,6 +23,9 @@ Parameters:
 * `-port <N>`       -- Port number.
                        Default: "5025" (lxi raw protocol).
 * `-timeout <N>`    -- Read timeout, seconds. No timeout if <=0.
+                       Also limited by request deadline. If a request is
+                       abandoned because of the deadline the connection
+                       is closed and reopened before the next request.
                        Default 5.0.
 * `-bufsize <N>`    -- Buffer size for reading. Maximum length of read data.
                        Default: 4096
@@ -32,6 +35,20 @@ Parameters:
                        This could be useful for some strange devices (Siglent power supplies)
                        which need some time between closing previous connection and opening
                        a new one.
+* `-conn_timeout <v>` -- Connection timeout, s. If the address has a few
+                       IP addresses (e.g. IPv4 and IPv6) they are tried in
+                       parallel. Default: 5.0.
+* `-dns_ttl <v>`    -- Time to keep resolved addresses, s. The cache is shared
+                       between all net devices. 0 -- do not cache. Default: 60.
+* `-nodelay (0|1)`  -- Set TCP_NODELAY option (send short messages
+                       without waiting). Default: 1.
+* `-keepalive <v>`  -- Send TCP keepalive probes if the connection is idle for
+                       this time, s. Broken connection is detected after
+                       three more probes. 0 -- do not send. Default: 60.
+* `-retry (0|1)`    -- If the connection is broken (e.g. the device was
+                       rebooted), reconnect and repeat the request once.
+                       After the message was sent only queries (with `?`)
+                       are repeated. Default: 1.
 * `-errpref <str>`  -- Prefix for error messages.
                        Default: "IOSerial: "
 * `-idn <str>`      -- Override output of *idn? command.
@@ -54,6 +71,19 @@ protected:
   std::string add,trim;
   read_cond_t read_cond;
   double delay;
+  std::string addr, port;
+  double open_delay;
+  double conn_timeout;
+  double dns_ttl;
+  bool nodelay;
+  int keepalive;
+  bool retry;
+
+  // open connection (sockfd)
+  void open_conn();
+
+  // close broken connection, throw an error
+  void conn_lost(const std::string & msg, int err = 0);
 
 public:
 
@@ -39,8 +39,11 @@ public:
     Driver_net(set_opt(opts)) {}
 
   std::string read() override {
+    auto t = times.send; // keep send time of the message
     sel_device();
-    return Driver_net::read();
+    auto ret = Driver_net::read();
+    times.send = t;
+    return ret;
   }
 
   void write(const std::string & msg) override {
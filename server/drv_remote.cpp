@@ -0,0 +1,410 @@
+#include "drv_remote.h"
+#include "bin_proto.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <cstring>
+#include <cstdlib>
+#include <sstream>
+#include <map>
+#include <set>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+/*************************************************/
+// Connection to a remote server, shared by all remote drivers
+// with the same address and port.
+
+class RemoteConn {
+  std::string addr, port, errpref;
+  double conn_timeout;
+  int fd;
+  uint32_t next_id;
+
+  std::mutex m;
+  std::condition_variable cv;
+  bool broken;          // connection should be reopened
+  bool opening;         // a thread is connecting
+  uint64_t gen;         // connection generation
+  std::string conn_err; // why the connection was lost
+  bool writing, reading;
+  std::string outq;     // frames waiting for sending
+  std::vector<uint32_t> outq_ids; // their request IDs
+  std::string inbuf;    // received data (incomplete frames)
+  std::set<uint32_t> pending;            // requests waiting for responses
+  std::map<uint32_t, BinResponse> done;  // received responses
+  std::set<uint32_t> unsent; // requests of a lost connection which were not written
+
+  // Connect to the server (without locking), return the socket.
+  // Connection time is limited by conn_timeout and t_end.
+  int connect(const Driver::clock::time_point & t_end);
+
+  // Mark the connection as broken, wake up all requests (m locked).
+  void lost(const std::string & msg);
+
+public:
+  RemoteConn(const std::string & addr, const std::string & port,
+             const double conn_timeout):
+    addr(addr), port(port), errpref("remote: " + addr + ":" + port + ": "),
+    conn_timeout(conn_timeout), fd(-1), next_id(0), broken(true),
+    opening(false), gen(0), writing(false), reading(false) {}
+
+  ~RemoteConn() {if (fd>=0) ::close(fd);}
+
+  // Send a request, wait for the response until t_end.
+  // If the connection is lost (Err with DRV_CONN_LOST code) and
+  // `sent` is not NULL, *sent is set to false if the request was not
+  // written to the socket (it can be repeated safely).
+  BinResponse call(BinRequest & req, const Driver::clock::time_point & t_end,
+                   bool * sent = NULL);
+};
+
+int
+RemoteConn::connect(const Driver::clock::time_point & t_end){
+  double t = conn_timeout;
+  if (t_end != Driver::clock::time_point::max()){
+    double dt = std::chrono::duration<double>(t_end - Driver::clock::now()).count();
+    if (dt <= 0) throw Err(DRV_CONN_ERR) << errpref << "connection timeout";
+    if (t<=0 || dt<t) t = dt;
+  }
+
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int e = getaddrinfo(addr.c_str(), port.c_str(), &hints, &res);
+  if (e) throw Err() << errpref << "getaddrinfo: " << gai_strerror(e);
+
+  // SO_SNDTIMEO limits connect() time
+  struct timeval tv;
+  tv.tv_sec  = int(t);
+  tv.tv_usec = (t - int(t))*1e6;
+  int err = 0, fd = -1;
+  for (auto p = res; p!=NULL; p = p->ai_next){
+    int s = socket(p->ai_family, p->ai_socktype | SOCK_CLOEXEC, p->ai_protocol);
+    if (s<0) {err = errno; continue;}
+    if (t>0) setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (::connect(s, p->ai_addr, p->ai_addrlen) == 0) {fd = s; break;}
+    err = errno;
+    ::close(s);
+  }
+  freeaddrinfo(res);
+  if (fd<0) throw Err(DRV_CONN_LOST) << errpref
+    << "can't connect: " << strerror(err);
+
+  struct timeval tv0 = {0,0};
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv0, sizeof(tv0));
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+  return fd;
+}
+
+void
+RemoteConn::lost(const std::string & msg){
+  if (broken) return;
+  broken = true;
+  conn_err = msg;
+  gen++;
+  unsent.insert(outq_ids.begin(), outq_ids.end());
+  outq.clear();
+  outq_ids.clear();
+  pending.clear();
+  done.clear();
+  // IO in other threads is interrupted, the socket is closed
+  // when the connection is reopened
+  shutdown(fd, SHUT_RDWR);
+  cv.notify_all();
+}
+
+BinResponse
+RemoteConn::call(BinRequest & req, const Driver::clock::time_point & t_end,
+                 bool * sent){
+  if (sent) *sent = false;
+  std::unique_lock<std::mutex> lk(m);
+
+  // Reopen the connection when nobody uses the old socket.
+  // Connect without holding the lock: requests to other
+  // devices wait only up to their deadlines.
+  while (broken){
+    auto ready = [this]{return !reading && !writing && !opening;};
+    if (t_end == Driver::clock::time_point::max()) cv.wait(lk, ready);
+    else if (!cv.wait_until(lk, t_end, ready))
+      throw Err(DRV_CONN_ERR) << errpref << "connection timeout";
+    if (!broken) break;
+    opening = true;
+    lk.unlock();
+    int f = -1;
+    std::string err;
+    int code = 0;
+    try { f = connect(t_end); }
+    catch (Err & e) { err = e.str(); code = e.code(); }
+    lk.lock();
+    opening = false;
+    cv.notify_all();
+    if (f<0) throw Err(code) << err;
+    if (fd>=0) ::close(fd);
+    fd = f;
+    inbuf.clear();
+    broken = false;
+  }
+
+  auto g = gen;
+  req.id = next_id++;
+  pending.insert(req.id);
+  outq += bin_pack(req);
+  outq_ids.push_back(req.id);
+
+  // Only one thread writes, it also sends frames queued by others
+  // while it was writing.
+  while (!writing && outq.size() && gen==g){
+    writing = true;
+    std::string buf;
+    std::vector<uint32_t> ids;
+    buf.swap(outq);
+    ids.swap(outq_ids);
+    int f = fd;
+    lk.unlock();
+    int e = 0;
+    size_t n = 0;
+    while (n < buf.size()){
+      auto ret = ::send(f, buf.data()+n, buf.size()-n, MSG_NOSIGNAL);
+      if (ret<0 && errno == EINTR) continue;
+      if (ret<0) {e = errno; break;}
+      n += ret;
+    }
+    lk.lock();
+    writing = false;
+    if (e && n==0) unsent.insert(ids.begin(), ids.end());
+    if (e) lost(std::string("write error: ") + strerror(e));
+    cv.notify_all();
+  }
+
+  // Wait for the response. One thread reads the socket and
+  // distributes responses, others wait.
+  while (1){
+    auto i = done.find(req.id);
+    if (i != done.end()){
+      auto r = i->second;
+      done.erase(i);
+      return r;
+    }
+    if (gen != g){
+      bool w = unsent.erase(req.id)==0;
+      if (sent) *sent = w;
+      throw Err(DRV_CONN_LOST) << errpref << conn_err;
+    }
+
+    auto now = Driver::clock::now();
+    if (now >= t_end){
+      pending.erase(req.id); // late response will be skipped
+      throw Err(DRV_CONN_ERR) << errpref << "read timeout";
+    }
+
+    if (reading){
+      if (t_end == Driver::clock::time_point::max()) cv.wait(lk);
+      else cv.wait_until(lk, t_end);
+      continue;
+    }
+
+    reading = true;
+    int f = fd;
+    lk.unlock();
+    int ms = -1;
+    if (t_end != Driver::clock::time_point::max())
+      ms = std::chrono::duration_cast<std::chrono::milliseconds>(t_end - now).count() + 1;
+    struct pollfd p = {f, POLLIN, 0};
+    int res = poll(&p, 1, ms);
+    int e = res<0 ? errno : 0;
+    char buf[65536];
+    ssize_t nr = 0;
+    if (res>0) {
+      nr = ::recv(f, buf, sizeof(buf), 0);
+      if (nr<0) e = errno;
+    }
+    lk.lock();
+    reading = false;
+
+    if (res<0 && e!=EINTR) lost(std::string("poll error: ") + strerror(e));
+    else if (res>0 && nr<0 && e!=EINTR) lost(std::string("read error: ") + strerror(e));
+    else if (res>0 && nr==0) lost("connection closed by the server");
+    else if (nr>0 && gen==g){
+      // extract complete frames
+      inbuf.append(buf, nr);
+      try {
+        while (inbuf.size()>=4){
+          uint32_t len = 0;
+          for (int k=0; k<4; k++) len = (len<<8) | (uint8_t)inbuf[k];
+          if (len > BIN_MAX_FRAME)
+            throw Err() << "binary protocol: too long frame: " << len;
+          if (inbuf.size() < 4+len) break;
+          auto r = bin_unpack_response(inbuf.substr(4, len));
+          inbuf.erase(0, 4+len);
+          if (pending.erase(r.id)) done[r.id] = r;
+        }
+      }
+      catch (Err & err) {lost(err.str());}
+    }
+    cv.notify_all();
+  }
+}
+
+/*************************************************/
+// Registry of connections: "addr:port" -> connection
+
+namespace {
+std::mutex conns_mutex;
+std::map<std::string, std::weak_ptr<RemoteConn> > conns;
+
+std::shared_ptr<RemoteConn>
+get_conn(const std::string & addr, const std::string & port,
+         const double conn_timeout){
+  std::lock_guard<std::mutex> lk(conns_mutex);
+  auto & w = conns[addr + ":" + port];
+  auto c = w.lock();
+  if (!c) {
+    c.reset(new RemoteConn(addr, port, conn_timeout));
+    w = c;
+  }
+  return c;
+}
+}
+
+std::string
+remote_request(const std::string & addr, const std::string & port,
+  const std::string & act, const std::string & arg, const std::string & msg,
+  const Opt & opts, const double timeout){
+  BinRequest r;
+  r.act  = act;
+  r.arg  = arg;
+  r.msg  = msg;
+  r.opts = opts;
+  auto t = timeout>0 ? Driver::clock::now() +
+             std::chrono::duration_cast<Driver::clock::duration>(
+               std::chrono::duration<double>(timeout))
+                     : Driver::clock::time_point::max();
+  auto resp = get_conn(addr, port, 5.0)->call(r, t);
+  if (resp.err) throw Err() << resp.data;
+  return resp.data;
+}
+
+/*************************************************/
+
+Driver_remote::Driver_remote(const Opt & opts): has_ans(false) {
+  opts.check_unknown({"addr", "port", "dev", "timeout", "conn_timeout",
+                      "retry", "ts", "errpref"});
+  errpref = opts.get("errpref", "remote: ");
+
+  auto addr = opts.get("addr", "");
+  auto port = opts.get("port", "");
+  dev = opts.get("dev", "");
+  if (addr=="") throw Err() << errpref
+    << "Parameter -addr is empty or missing";
+  if (port=="") throw Err() << errpref
+    << "Parameter -port is empty or missing";
+  if (dev=="") throw Err() << errpref
+    << "Parameter -dev is empty or missing";
+
+  timeout = opts.get("timeout", 20.0);
+  retry   = opts.get("retry", true);
+  ts      = opts.get("ts", true);
+  conn = get_conn(addr, port, opts.get("conn_timeout", 5.0));
+
+  // check that the remote device exists
+  errpref += addr + ":" + port + ":" + dev + ": ";
+  BinRequest r;
+  r.act = "info";
+  r.arg = dev;
+  auto t = timeout>0 ? clock::now() + std::chrono::duration_cast<clock::duration>(
+                         std::chrono::duration<double>(timeout))
+                     : clock::time_point::max();
+  auto resp = conn->call(r, t);
+  if (resp.err) throw Err() << errpref << resp.data;
+}
+
+std::string
+Driver_remote::read() {
+  if (!has_ans) throw Err() << errpref << "no answer to read";
+  has_ans = false;
+  return ans;
+}
+
+void
+Driver_remote::write(const std::string & msg) {
+  ans = ask(msg);
+  has_ans = true;
+}
+
+// parse "<send time> <send mono> <recv time> <recv mono>\n" line
+static void
+parse_times(std::string & ans, Driver::Times & tm){
+  auto n = ans.find('\n');
+  if (n == std::string::npos) return;
+  std::istringstream ss(ans.substr(0, n));
+  std::string s[4];
+  ss >> s[0] >> s[1] >> s[2] >> s[3];
+  ans.erase(0, n+1);
+  struct timespec t[4];
+  for (int i=0; i<4; i++){
+    auto p = s[i].find('.');
+    t[i].tv_sec  = atol(s[i].substr(0,p).c_str());
+    t[i].tv_nsec = p==std::string::npos ? 0 :
+                   atol((s[i].substr(p+1) + "000000000").substr(0,9).c_str());
+  }
+  tm.send.rt = t[0];
+  tm.recv.rt = t[2];
+  // monotonic times of another computer are useless,
+  // convert realtime ones to the local monotonic clock
+  Driver::TimeStamp now;
+  now.set();
+  for (auto x: {&tm.send, &tm.recv}){
+    int64_t dt = (now.rt.tv_sec - x->rt.tv_sec)*1000000000LL
+               + (now.rt.tv_nsec - x->rt.tv_nsec);
+    int64_t m = now.mono.tv_sec*1000000000LL + now.mono.tv_nsec - dt;
+    x->mono.tv_sec  = m/1000000000LL;
+    x->mono.tv_nsec = m%1000000000LL;
+  }
+}
+
+std::string
+Driver_remote::ask(const std::string & msg) {
+  has_ans = false;
+  BinRequest r;
+  r.act = "ask";
+  r.arg = dev;
+  r.msg = msg;
+  if (ts) r.opts.put("ts", 1);
+
+  // pass the deadline to the remote server
+  double t = get_timeout(timeout);
+  if (deadline != clock::time_point::max()) r.opts.put("deadline", t);
+  auto t_end = t>0 ? clock::now() + std::chrono::duration_cast<clock::duration>(
+                       std::chrono::duration<double>(t))
+                   : clock::time_point::max();
+
+  // If the connection is broken, reconnect and repeat the request once
+  // (only if the message was not sent, or it is a query: commands
+  // should not be executed twice).
+  BinResponse resp;
+  bool sent = true;
+  try {
+    resp = conn->call(r, t_end, &sent);
+  }
+  catch (Err & e) {
+    if (expired()) throw Err() << errpref << "request deadline expired";
+    if (!retry || e.code() != DRV_CONN_LOST) throw;
+    if (sent && msg.find('?') == std::string::npos) throw;
+    resp = conn->call(r, t_end);
+  }
+
+  // remote errors are passed as is
+  if (resp.err) throw Err() << resp.data;
+  if (ts) parse_times(resp.data, times);
+  return resp.data;
+}
@@ -0,0 +1,69 @@
+#ifndef DRV_REMOTE_H
+#define DRV_REMOTE_H
+
+#include <memory>
+#include "drv.h"
+#include "opt/opt.h"
+
+/*************************************************/
+/*
+ * Driver `remote` -- devices of another device_d server
+ *
+
+Messages are sent to a device of a remote server using the binary
+protocol (server should be started with --bin_port option). All remote
+devices of one server share a persistent connection, requests of
+different devices are pipelined: frames waiting for sending are written
+together, responses are matched by request IDs.
+
+Errors of the remote device are returned as is. Request deadline is
+passed to the remote server. Send and receive times are taken by the
+remote driver (see `ts` argument of the `ask` action).
+
+Parameters:
+
+* `-addr <v>`       -- Address of the remote server. Required.
+* `-port <N>`       -- Binary protocol port of the remote server. Required.
+* `-dev <v>`        -- Name of the device on the remote server. Required.
+* `-timeout <v>`    -- Timeout for getting an answer, s. No timeout if <=0.
+                       Also limited by request deadline. Default: 20.
+* `-conn_timeout <v>` -- Connection timeout, s. Default: 5.0.
+* `-retry (0|1)`    -- If the connection is broken (e.g. the remote server
+                       was restarted), reconnect and repeat the request once.
+                       After the request was sent only queries (with `?`)
+                       are repeated. Default: 1.
+* `-ts (0|1)`       -- Get send and receive times from the remote server.
+                       Default: 1.
+* `-errpref <str>`  -- Prefix for error messages (remote errors are
+                       returned without it). Default: "remote: ".
+*/
+
+class RemoteConn;
+
+// Send a request to another device_d server (binary protocol) and
+// return the answer. Connections are shared with remote drivers.
+// Throw Err with the remote error message if the request fails.
+// No timeout if timeout<=0.
+std::string remote_request(const std::string & addr, const std::string & port,
+  const std::string & act, const std::string & arg, const std::string & msg,
+  const Opt & opts, const double timeout);
+
+class Driver_remote: public Driver {
+  std::shared_ptr<RemoteConn> conn;
+  std::string dev, errpref;
+  double timeout;
+  bool retry, ts;
+  std::string ans; // answer for read()
+  bool has_ans;
+
+public:
+
+  Driver_remote(const Opt & opts);
+
+  // write() sends the message and keeps the answer for read()
+  std::string read() override;
+  void write(const std::string & msg) override;
+  std::string ask(const std::string & msg) override;
+};
+
+#endif
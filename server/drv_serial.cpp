@@ -1,5 +1,6 @@
 #include "drv_serial.h"
 #include "drv_utils.h"
+#include "drv_io.h"
 
 // read/write/open/close/fctl
 #include <unistd.h>
@@ -367,6 +368,7 @@ Driver_serial::Driver_serial(const Opt & opts) {
   idn    = opts.get("idn", "");
   read_cond = str_to_read_cond(opts.get("read_cond", "always"));
   flush_on_err = opts.get<bool>("flush_on_err", true);
+  stale = false;
 }
 
 
@@ -384,18 +386,28 @@ Driver_serial::read() {
   while(1){
     // read data, add to ret string
     char buf[4096]; // limit of the serial driver
-    ssize_t res = ::read(fd,buf,sizeof(buf));
+
+    // In blocking mode wait for data until the request deadline.
+    double t = 0;
+    if (deadline != clock::time_point::max() &&
+        (fcntl(fd, F_GETFL) & O_NONBLOCK) == 0) t = get_timeout(0);
+
+    ssize_t res = io_read(fd, buf, sizeof(buf), t);
+    if (res<0 && errno==ETIME){
+      stale = true; // answer can arrive later
+      throw Err() << errpref << "request deadline expired";
+    }
 
     // non-blocking read, no data
     if (res<0 && errno==EAGAIN) break;
 
     if (res<0){
       if (flush_on_err) tcflush(fd, TCIOFLUSH);
-      throw Err() << errpref
+      throw Err(DRV_CONN_ERR) << errpref
         << "read error: " << strerror(errno);
     }
 
-    if (res==0) throw Err() << errpref
+    if (res==0) throw Err(DRV_CONN_ERR) << errpref
       << "read timeout";
     ret += std::string(buf, buf+res);
 
@@ -411,6 +423,7 @@ Driver_serial::read() {
     // read more data if nack or ack are not found.
   }
 
+  times.recv.set();
   trim_str(ret,trim); // -trim option
   if (fail) throw Err() << "nack from the device: " << ret;
   return ret;
@@ -422,10 +435,17 @@ Driver_serial::write(const std::string & msg) {
   std::string m = msg;
   if (add.size() > 0) m+=add;
 
+  // drop late answer to an abandoned request
+  if (stale){
+    tcflush(fd, TCIFLUSH);
+    stale = false;
+  }
+
+  times.send.set();
   ssize_t ret = ::write(fd, m.data(), m.size());
   if (ret<0){
     if (flush_on_err) tcflush(fd, TCIOFLUSH);
-    throw Err() << errpref
+    throw Err(DRV_CONN_ERR) << errpref
       << "write error: " << strerror(errno);
   }
 
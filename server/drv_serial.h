@@ -140,6 +140,7 @@ If option is missing no change is made.
 
 * `-timeout <v>` -- Timeout in seconds, [0..25.5] s.
                     Only valid in blocking, raw input mode (-raw=1 -ndelay=0).
+                    In blocking mode waiting is also limited by request deadline.
 
 * `-vmin <N>`    -- min number of characters [0..255]
                     Only valid in blocking, raw input mode (-raw=1 -ndelay=0).
@@ -194,6 +195,7 @@ protected:
   read_cond_t read_cond;
   double delay;
   bool flush_on_err;
+  bool stale; // a late answer can be in the input buffer
 
 public:
 
@@ -1,28 +1,92 @@
 #include "drv_spp.h"
 #include "err/err.h"
 #include <cstring> // strcasecmp
+#include <map>
+
+// Standby programs (-standby parameter): one started program for
+// each command line. They are stopped when the server exits.
+struct SppStandby {
+  std::mutex m;
+  std::map<std::string, std::unique_ptr<SppProc> > procs;
+  std::map<std::string, double> close_timeouts;
+
+  // take the program
+  std::unique_ptr<SppProc> get(const std::string & prog){
+    std::lock_guard<std::mutex> lk(m);
+    std::unique_ptr<SppProc> ret;
+    auto i = procs.find(prog);
+    if (i == procs.end()) return ret;
+    ret.swap(i->second);
+    procs.erase(i);
+    return ret;
+  }
+
+  // start a program if there is no one
+  void put(const std::string & prog, const double close_timeout){
+    std::lock_guard<std::mutex> lk(m);
+    if (procs.count(prog)) return;
+    try { procs[prog].reset(new SppProc(prog)); }
+    catch (Err & e) { procs.erase(prog); return; }
+    close_timeouts[prog] = close_timeout;
+  }
+
+  ~SppStandby(){
+    for (auto & p: procs){
+      p.second->close_input();
+      p.second->term(close_timeouts[p.first]);
+    }
+  }
+};
+static SppStandby spp_standby;
 
 std::string
-Driver_spp::read_spp(double timeout){
-  if (!flt) throw Err() << "SPP: read from closed device";
+Driver_spp::read_spp(Worker & w, double timeout){
+  if (!w.proc) throw Err() << "SPP: read from closed device";
   std::string ret;
   while (1){
     std::string l;
 
-    // Read from SPP program with timeout.
+    // Read from SPP program with timeout (limited by request deadline).
     // Err is thrown if error happens.
     // Return -1 on EOF.
-    int res = flt->getline(l, timeout);
-    if (res<0) throw Err() << "SPP: unexpected EOF: " << prog;
+    int res;
+    try { res = w.proc->getline(l, get_timeout(timeout)); }
+    catch (Err & e){
+      // If the request is abandoned because of the deadline, its answer
+      // should be skipped later. On other errors we can not keep track
+      // of answers anyway.
+      if (expired()) {
+        w.skip++;
+        throw Err() << "SPP: request deadline expired";
+      }
+      w.skip = 0;
+      throw Err(DRV_CONN_ERR) << e.str();
+    }
+    if (res<0) {
+      w.dead = true;
+      throw Err(DRV_CONN_ERR) << "SPP: unexpected EOF: " << prog;
+    }
     // line starts with the special character
-    if (l.size()>0 && l[0] == ch){
+    if (l.size()>0 && l[0] == w.ch){
+      bool end = l.substr(1,7) == "Error: " ||
+                 l.substr(1,7) == "Fatal: " ||
+                 l.substr(1) == "OK";
+      // skip answer to an abandoned request
+      if (end && w.skip>0){
+        w.skip--;
+        ret.clear();
+        continue;
+      }
       if (l.substr(1,7) == "Error: ") throw Err() << l.substr(8);
-      if (l.substr(1,7) == "Fatal: ") throw Err() << l.substr(8);
+      if (l.substr(1,7) == "Fatal: ") {
+        w.dead = true;
+        throw Err(DRV_CONN_ERR) << l.substr(8);
+      }
       if (l.substr(1) == "OK") return ret;
 
       if (ret.size()>0) ret += '\n';
-      if (l.size()>1 && l[1] == ch) ret += l.substr(1);
-      else throw Err() << "SPP: symbol " << ch <<
+      if (l.size()>1 && l[1] == w.ch) ret += l.substr(1);
+      else throw Err() << "SPP: symbol " << w.ch <<
         " in the beginning of a line is not protected: " << prog;
     }
     else {
@@ -32,9 +96,53 @@ Driver_spp::read_spp(double timeout){
   }
 }
 
+void
+Driver_spp::start(Worker & w){
+  // the standby program could exit, start a new one then
+  if (standby){
+    w.proc = spp_standby.get(prog);
+    if (w.proc) {
+      try { handshake(w); }
+      catch (Err & e) { stop(w); }
+    }
+  }
+  if (!w.proc){
+    w.proc.reset(new SppProc(prog));
+    try { handshake(w); }
+    catch (Err & e) { stop(w); throw; }
+  }
+  if (standby) spp_standby.put(prog, close_timeout);
+}
+
+void
+Driver_spp::handshake(Worker & w){
+  w.skip = 0;
+  w.dead = false;
+  // first line: <symbol>SPP<version>
+  std::string l;
+  w.proc->getline(l, open_timeout);
+  if (l.size()<5 || l[1]!='S' || l[2]!='P' || l[3]!='P')
+    throw Err() << errpref
+      << "not an SPP program, header expected";
+  w.ch = l[0];
+  int ver = str_to_type<int>(l.substr(4));
+  if (ver!=1 && ver!=2) throw Err() << errpref
+    <<"unsupported SPP version";
+  read_spp(w, open_timeout); // ignore message, throw errors
+}
+
+void
+Driver_spp::stop(Worker & w){
+  if (!w.proc) return;
+  w.proc->close_input();
+  w.proc->term(close_timeout);
+  w.proc.reset();
+}
+
 
 Driver_spp::Driver_spp(const Opt & opts) {
-  opts.check_unknown({"prog", "open_timeout", "read_timeout", "close_timeout", "errpref", "idn"});
+  opts.check_unknown({"prog", "open_timeout", "read_timeout", "close_timeout",
+                      "errpref", "idn", "workers", "standby"});
 
   //prefix for error messages
   errpref = opts.get("errpref", "spp: ");
@@ -49,27 +157,17 @@ Driver_spp::Driver_spp(const Opt & opts) {
   read_timeout = opts.get<double>("read_timeout", 10.0);
   close_timeout = opts.get<double>("close_timeout", 5.0);
 
-  flt.reset(new IOFilter(prog));
-  try {
+  standby = opts.get<bool>("standby", false);
+  pool = opts.exists("workers");
+  int n = opts.get<int>("workers", 1);
+  if (n<1) throw Err() << errpref << "bad number of workers: " << n;
 
-    // first line: <symbol>SPP<version>
-    std::string l;
-    flt->getline(l, open_timeout);
-    if (l.size()<5 || l[1]!='S' || l[2]!='P' || l[3]!='P')
-      throw Err() << errpref
-        << "not an SPP program, header expected";
-    ch  = l[0];
-    int ver = str_to_type<int>(l.substr(4));
-    if (ver!=1 && ver!=2) throw Err() << errpref
-      <<"unsupported SPP version";
-    read_spp(open_timeout); // ignore message, throw errors
+  workers.resize(n);
+  try {
+    for (auto & w: workers) start(w);
   }
   catch (Err e) {
-    if (flt){
-      flt->close_input();
-      flt->term(close_timeout);
-      flt.reset();
-    }
+    for (auto & w: workers) stop(w);
     throw;
   }
   idn = opts.get("idn", "");
@@ -78,31 +176,81 @@ Driver_spp::Driver_spp(const Opt & opts) {
 
 
 Driver_spp::~Driver_spp() {
-  if (!flt) return;
-  flt->close_input();
-  flt->term(close_timeout);
-  flt.reset();
+  for (auto & w: workers) stop(w);
 }
 
 std::string
 Driver_spp::read() {
-  if (!flt) throw Err() << errpref
+  if (pool) throw Err() << errpref
+    << "only ask is supported with -workers parameter";
+  if (!workers[0].proc) throw Err() << errpref
     << "device is closed";
-  return read_spp(read_timeout);
+  auto ret = read_spp(workers[0], read_timeout);
+  times.recv.set();
+  return ret;
 }
 
 void
 Driver_spp::write(const std::string & msg) {
-  if (!flt) throw Err() << errpref
+  if (pool) throw Err() << errpref
+    << "only ask is supported with -workers parameter";
+  if (!workers[0].proc) throw Err() << errpref
     << "device is closed";
-  flt->ostream() << msg << "\n";
-  flt->ostream().flush();
+  if (workers[0].dead) throw Err(DRV_CONN_ERR) << errpref
+    << "program has exited or reported a fatal error";
+  times.send.set();
+  try { workers[0].proc->write(msg + "\n"); }
+  catch (Err & e) { throw Err(DRV_CONN_ERR) << e.str(); }
 }
 
 
 std::string
 Driver_spp::ask(const std::string & msg) {
   if (idn.size() && strcasecmp(msg.c_str(),"*idn?")) return idn;
-  write(msg);
-  return read();
+  if (!pool) {
+    write(msg);
+    return read();
+  }
+
+  // Wait for a free program. Prefer running programs without
+  // answers to abandoned requests.
+  std::unique_lock<std::mutex> lk(pool_mutex);
+  auto down = [](const Worker & x){return x.dead || !x.proc;};
+  Worker * w = NULL;
+  while (1){
+    for (auto & x: workers){
+      if (x.busy) continue;
+      if (!w || (down(*w) && !down(x)) ||
+          (down(*w) == down(x) && x.skip < w->skip)) w = &x;
+    }
+    if (w) break;
+    if (deadline == clock::time_point::max()) pool_cond.wait(lk);
+    else if (pool_cond.wait_until(lk, deadline) == std::cv_status::timeout)
+      throw Err() << "SPP: request deadline expired";
+  }
+  w->busy = true;
+  lk.unlock();
+
+  // release the program when the request is finished
+  struct Release {
+    Driver_spp & d;
+    Worker & w;
+    Release(Driver_spp & d, Worker & w): d(d), w(w) {}
+    ~Release() {
+      std::lock_guard<std::mutex> lk(d.pool_mutex);
+      w.busy = false;
+      d.pool_cond.notify_one();
+    }
+  } rel(*this, *w);
+
+  // restart the program if needed
+  if (w->dead) stop(*w);
+  if (!w->proc) start(*w);
+
+  times.send.set();
+  try { w->proc->write(msg + "\n"); }
+  catch (Err & e) { w->dead = true; throw Err(DRV_CONN_ERR) << e.str(); }
+  auto ret = read_spp(*w, read_timeout);
+  times.recv.set();
+  return ret;
 }
@@ -1,8 +1,11 @@
 #ifndef DRV_SPP_H
 #define DRV_SPP_H
 
+#include <vector>
+#include <mutex>
+#include <condition_variable>
 #include "drv.h"
-#include "iofilter/iofilter.h"
+#include "spp_proc.h"
 
 /*************************************************/
 /* driver `spp` -- programs following "Simple Pipe protocol"
@@ -14,11 +17,16 @@ of my projects (pico_rec, graphene), and in `device_c` client program.
 
 Parameters:
 
-* `-prog`          -- Program name. Required.
+* `-prog`          -- Program name. Required. It is started without shell
+                      if it is a plain list of words (no quotes, variables,
+                      redirections, etc.).
 
 * `-open_timeout`  -- Timeout for opening, seconds. Default 20.0.
 
 * `-read_timeout`  -- Timeout for reading, seconds. Default: 10.0.
+                      Also limited by request deadline. If a request is
+                      abandoned because of the deadline its answer is
+                      skipped before reading the next one.
 
 * `-close_timeout`  -- Timeout for closing (before sending SIGTERM), seconds. Default: 5.0.
 
@@ -26,19 +34,54 @@ Parameters:
 
 * `-idn`     -- Override output of *idn? command. Default: do not override.
 
+* `-workers`  -- Run a pool of N identical programs (for stateless programs
+                 which can process requests independently). Requests are
+                 sent in parallel to free programs, a program which exits
+                 or sends #Fatal error is restarted before the next
+                 request. Only `ask` is supported in this mode. Default:
+                 one program, no restarts.
+
+* `-standby`  -- Keep one more started program (for each -prog value)
+                 in standby, it is used when the device is reopened or a
+                 program is restarted. Useful for programs with long
+                 startup time. Default: 0.
+
 */
 
 class Driver_spp: public Driver {
-  std::shared_ptr<IOFilter> flt;
+
+  // SPP program
+  struct Worker {
+    std::unique_ptr<SppProc> proc;
+    char ch;   // protocol special character
+    int skip;  // number of answers to abandoned requests to be skipped
+    bool busy; // used by a request
+    bool dead; // program exited or sent #Fatal error, restart it
+    Worker(): ch('#'), skip(0), busy(false), dead(false) {}
+  };
+  std::vector<Worker> workers;
+  bool pool; // -workers parameter is set
+  bool standby;
+  std::mutex pool_mutex;
+  std::condition_variable pool_cond;
+
   std::string prog;
-  char ch; // protocol special character
   int ver; // protocol version
   double open_timeout, read_timeout, close_timeout;
   std::string errpref; // error prefix
   std::string idn;
 
+  // start the program (or take the standby one), read the header
+  void start(Worker & w);
+
+  // read the header
+  void handshake(Worker & w);
+
+  // stop the program
+  void stop(Worker & w);
+
   // read SPP message until #OK or #Error line
-  std::string read_spp(double timeout = -1);
+  std::string read_spp(Worker & w, double timeout = -1);
 
 public:
 
@@ -48,6 +91,7 @@ public:
   std::string read() override;
   void write(const std::string & msg) override;
   std::string ask(const std::string & msg) override;
+  bool parallel() const override {return pool;}
 };
 
 #endif
@@ -1,5 +1,9 @@
 ///\cond HIDDEN (do not show this in Doxyden)
 
+#include <thread>
+#include <vector>
+#include <cassert>
+#include <unistd.h>
 #include "drv_spp.h"
 #include "err/assert_err.h"
 
@@ -42,6 +46,87 @@ main(){
       Driver_spp d(o);
     }
 
+    // request deadline: answer to the abandoned request is skipped
+    {
+      o.put("prog", "echo '#SPP1\n#OK'; while read x; do sleep $x; echo \"Q: $x\"; echo '#OK'; done");
+      Driver_spp d(o);
+      assert_eq(d.ask("0"), "Q: 0");
+      d.set_deadline(Driver::clock::now() + std::chrono::milliseconds(100));
+      assert_err(d.ask("0.3"), "SPP: request deadline expired");
+      assert_err(d.ask("0"), "SPP: request deadline expired");
+      d.set_deadline(Driver::clock::time_point::max());
+      assert_eq(d.ask("0.1"), "Q: 0.1");
+    }
+
+    // pool of programs
+    {
+      o.put("prog", "echo '#SPP1\n#OK'; while read x; do"
+        " case $x in fatal) echo '#Fatal: fatal'; exit;; exit) exit;; esac;"
+        " sleep $x; echo $$; echo '#OK'; done");
+      o.put("workers", 0);
+      assert_err(Driver_spp d(o),
+        "spp: " + o.get("prog") + ": bad number of workers: 0");
+
+      // restart after #Fatal error and EOF
+      o.put("workers", 1);
+      {
+        Driver_spp d(o);
+        assert_eq(d.parallel(), true);
+        assert_err(d.read(),
+          "spp: " + o.get("prog") + ": only ask is supported with -workers parameter");
+        auto p1 = d.ask("0");
+        assert_eq(d.ask("0"), p1);
+        assert_err(d.ask("fatal"), "fatal");
+        auto p2 = d.ask("0");
+        assert(p2 != p1);
+        assert_err(d.ask("exit"), "SPP: unexpected EOF: " + o.get("prog"));
+        assert(d.ask("0") != p2);
+      }
+
+      // parallel requests
+      o.put("workers", 3);
+      {
+        Driver_spp d(o);
+        vector<string> res(3);
+        vector<thread> th;
+        auto t0 = Driver::clock::now();
+        for (int i=0; i<3; i++)
+          th.emplace_back([&d,&res,i]{ res[i] = d.ask("0.2"); });
+        for (auto & t: th) t.join();
+        auto dt = std::chrono::duration<double>(Driver::clock::now()-t0).count();
+        assert(dt < 0.5);
+        assert(res[0]!=res[1] && res[1]!=res[2] && res[0]!=res[2]);
+
+        // waiting for a free program is limited by the deadline
+        thread t1([&d]{ d.ask("0.3"); });
+        thread t2([&d]{ d.ask("0.3"); });
+        thread t3([&d]{ d.ask("0.3"); });
+        usleep(50000);
+        d.set_deadline(Driver::clock::now() + std::chrono::milliseconds(100));
+        assert_err(d.ask("0"), "SPP: request deadline expired");
+        d.set_deadline(Driver::clock::time_point::max());
+        t1.join(); t2.join(); t3.join();
+      }
+    }
+
+    // standby program is used when the device is reopened
+    {
+      Opt o;
+      o.put("prog", "sleep 0.3; echo '#SPP1\n#OK'; while read x; do echo $$; echo '#OK'; done");
+      o.put("standby", 1);
+      string p1;
+      {
+        Driver_spp d(o);
+        p1 = d.ask("a");
+      }
+      usleep(400000);
+      auto t0 = Driver::clock::now();
+      Driver_spp d(o);
+      auto dt = std::chrono::duration<double>(Driver::clock::now()-t0).count();
+      assert(dt < 0.2);
+      assert(d.ask("a") != p1);
+    }
+
   }
   catch (Err e) {
     std::cerr << "Error: " << e.str() << "\n";
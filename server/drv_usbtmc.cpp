@@ -75,9 +75,10 @@ Driver_usbtmc::read() {
       auto en = errno; // save errno to show the error later
       // Recover from failed read (if auto_abort is off).
       if (!auto_abort) ioctl(fd,USBTMC_IOCTL_CLEAR,NULL);
-      throw Err() << errpref
+      throw Err(DRV_CONN_ERR) << errpref
         << "read error: " << strerror(en);
     }
+    times.recv.set();
     ret += std::string(buf, buf+res);
 
     // Sometimes STB is set after a short delay after read
@@ -89,7 +90,7 @@ Driver_usbtmc::read() {
     // (such as Keysight multiplexer read? command)
     uint8_t stb;
     res = ioctl(fd,USBTMC488_IOCTL_READ_STB, &stb);
-    if (res<0) throw Err() << errpref
+    if (res<0) throw Err(DRV_CONN_ERR) << errpref
       << "can't get status byte: " << strerror(errno);
     if (!(stb & (1<<4))) break;
 
@@ -106,12 +107,13 @@ Driver_usbtmc::write(const std::string & msg) {
   std::string m = msg;
   if (add.size()>0) m+=add;
 
+  times.send.set();
   auto res = ::write(fd, m.data(), m.size());
   if (res<0){
     auto en = errno; // save errno to show the error later
     // Recover from failed read (if auto_abort is off).
     if (!auto_abort) ioctl(fd,USBTMC_IOCTL_CLEAR,NULL);
-    throw Err() << errpref
+    throw Err(DRV_CONN_ERR) << errpref
       << "read error: " << strerror(en);
   }
   if (delay>0) usleep(delay*1e6);
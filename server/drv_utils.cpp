@@ -33,3 +33,41 @@ check_read_cond(const std::string & msg, const int cond){
   }
   throw Err() << "bad read_cond: " << cond;
 }
+
+bool
+scpi_mergeable(const std::string & msg){
+  return msg.find('?') != std::string::npos &&
+         msg.find_first_of(";\n") == std::string::npos;
+}
+
+std::string
+scpi_merge(const std::vector<std::string> & msgs){
+  std::string ret;
+  for (auto const & m: msgs){
+    if (ret.size()){
+      ret += ';';
+      if (m.size() && m[0]!=':' && m[0]!='*') ret += ':';
+    }
+    ret += m;
+  }
+  return ret;
+}
+
+std::vector<std::string>
+scpi_split(const std::string & ans, const std::string & sep){
+  std::vector<std::string> ret;
+  if (sep.size()==0) {ret.push_back(ans); return ret;}
+  size_t b = 0;
+  char q = 0; // current quote character
+  for (size_t i = 0; i<ans.size(); i++){
+    if (q) { if (ans[i]==q) q = 0; continue; }
+    if (ans[i]=='"' || ans[i]=='\'') { q = ans[i]; continue; }
+    if (ans.compare(i, sep.size(), sep) == 0){
+      ret.push_back(ans.substr(b, i-b));
+      i += sep.size()-1;
+      b = i+1;
+    }
+  }
+  ret.push_back(ans.substr(b));
+  return ret;
+}
@@ -2,6 +2,7 @@
 #define DRV_UTILS_H
 
 #include <string>
+#include <vector>
 
 // Trim substring `trim` from the end of `str` (if it is there).
 // Return true if the trimming is done.
@@ -22,6 +23,22 @@ read_cond_t str_to_read_cond(const std::string & str);
 // Check if the message contains no question marks
 bool check_read_cond(const std::string & msg, const int cond);
 
+
+// SCPI compound queries (used for -merge_window device parameter).
+
+// Can the message be merged with others: a single query
+// (with a question mark, without ';' and newlines).
+bool scpi_mergeable(const std::string & msg);
+
+// Join queries into a compound command: "VOLT?", "CURR?" -> "VOLT?;:CURR?".
+// ':' is added to all queries except the first one and common
+// commands (*IDN? etc.) to reset the header path.
+std::string scpi_merge(const std::vector<std::string> & msgs);
+
+// Split answer of a compound query. Separators inside quoted
+// strings are skipped.
+std::vector<std::string> scpi_split(const std::string & ans, const std::string & sep);
+
 #endif
 
 
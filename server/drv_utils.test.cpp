@@ -2,6 +2,7 @@
 
 #include "drv_utils.h"
 #include "err/assert_err.h"
+#include <cassert>
 
 using namespace std;
 
@@ -29,6 +30,25 @@ main(){
     assert_eq(check_read_cond("DISP:TEXT WHAT?!", READCOND_QMARK1W),  false);
     assert_eq(check_read_cond("DISP:TEXT? (1)", READCOND_QMARK1W),  true);
 
+    // SCPI compound queries
+    assert_eq(scpi_mergeable("VOLT?"), true);
+    assert_eq(scpi_mergeable("VOLT 1"), false);
+    assert_eq(scpi_mergeable("VOLT?;CURR?"), false);
+    assert_eq(scpi_mergeable("VOLT?\nCURR?"), false);
+
+    assert_eq(scpi_merge({"VOLT?"}), "VOLT?");
+    assert_eq(scpi_merge({"SOUR:VOLT?", "CURR?", "*IDN?", ":OUTP?"}),
+      "SOUR:VOLT?;:CURR?;*IDN?;:OUTP?");
+
+    assert(scpi_split("1.0;2;ON", ";") ==
+      std::vector<std::string>({"1.0", "2", "ON"}));
+    assert(scpi_split("\"a;b\";'c;d';", ";") ==
+      std::vector<std::string>({"\"a;b\"", "'c;d'", ""}));
+    assert(scpi_split("1, 2, 3", ", ") ==
+      std::vector<std::string>({"1", "2", "3"}));
+    assert(scpi_split("", ";") == std::vector<std::string>({""}));
+    assert(scpi_split("a;b", "") == std::vector<std::string>({"a;b"}));
+
   }
   catch (Err e) {
     std::cerr << "Error: " << e.str() << "\n";
@@ -1,6 +1,7 @@
 #ifdef USE_VXI
 
 #include <cstring>
+#include <cstdint>
 #include "drv_utils.h"
 #include "drv_vxi.h"
 #include <unistd.h>
@@ -9,8 +10,8 @@
 
 Driver_vxi::Driver_vxi(const Opt & opts) {
 
-  opts.check_unknown({"addr","name",
-    "rpc_timeout","io_timeout","lock_timeout"
+  opts.check_unknown({"addr","name","port",
+    "rpc_timeout","io_timeout","lock_timeout", "read_size", "termchar",
     "errpref", "idn", "read_cond", "add_str", "trim_str", "delay"});
 
   //prefix for error messages
@@ -23,18 +24,31 @@ Driver_vxi::Driver_vxi(const Opt & opts) {
     << "Parameter -addr is empty or missing";
   if (name=="") throw Err() << errpref
     << "Parameter -name is empty or missing";
+  int port = opts.get("port", 0);
 
   // timeouts
-  double rpc_timeout  = opts.get<double>("rpc_timeout",   2.0);
-  double io_timeout   = opts.get<double>("io_timeout",    2.0);
+  rpc_timeout  = opts.get<double>("rpc_timeout",   2.0);
+  io_timeout   = opts.get<double>("io_timeout",    2.0);
   double lock_timeout = opts.get<double>("lock_timeout", 10.0);
 
+  auto rsize = opts.get<int64_t>("read_size", 1<<20);
+  termchar  = opts.get("termchar", -1);
+  // requestSize is a 32-bit value in the protocol
+  if (rsize<1 || rsize>UINT32_MAX) throw Err() << errpref
+    << "bad -read_size value: " << rsize;
+  read_size = rsize;
+
   errpref += addr + ":" + name + ": ";
 
-  dev.reset(new VXI(addr.c_str(), name.c_str(), rpc_timeout));
-  dev->set_io_timeout(io_timeout);
-  dev->set_lock_timeout(lock_timeout);
-  dev->clear();
+  try {
+    dev.reset(new VXIClient(addr, name, port, rpc_timeout));
+    dev->io_timeout = io_timeout*1000;
+    dev->lock_timeout = lock_timeout*1000;
+    dev->clear(rpc_timeout + io_timeout);
+  }
+  catch (Err & e){
+    throw Err() << errpref << e.str();
+  }
 
   add     = opts.get("add_str",  "\n");
   trim    = opts.get("trim_str", "\n");
@@ -43,18 +57,42 @@ Driver_vxi::Driver_vxi(const Opt & opts) {
   read_cond = str_to_read_cond(opts.get("read_cond", "qmark1w"));
 }
 
+double
+Driver_vxi::set_timeout(){
+  // device-side timeout: up to the request deadline,
+  // local timeout: rpc_timeout more
+  double t = get_timeout(io_timeout);
+  dev->io_timeout = t*1000;
+  return t + rpc_timeout;
+}
+
 std::string
 Driver_vxi::read() {
-  std::string ret = dev->read();
+  std::string ret;
+  try {
+    ret = dev->read(read_size, termchar, set_timeout());
+    times.recv.set();
+  }
+  catch (Err & e){
+    if (expired()) throw Err() << errpref << "request deadline expired";
+    bool conn = e.code()==VXI_CONN_ERR || e.code()==VXI_TIMEOUT;
+    throw Err(conn? DRV_CONN_ERR:-1) << errpref << e.str();
+  }
   trim_str(ret,trim); // -trim option
   return ret;
 }
 
 void
 Driver_vxi::write(const std::string & msg) {
-  std::string m = msg;
-  if (add.size()>0) m+=add;
-  dev->write(m.c_str());
+  try {
+    times.send.set();
+    dev->write(msg, add, set_timeout());
+  }
+  catch (Err & e){
+    if (expired()) throw Err() << errpref << "request deadline expired";
+    bool conn = e.code()==VXI_CONN_ERR || e.code()==VXI_TIMEOUT;
+    throw Err(conn? DRV_CONN_ERR:-1) << errpref << e.str();
+  }
   if (delay>0) usleep(delay*1e6);
 }
 
@@ -71,4 +109,4 @@ Driver_vxi::ask(const std::string & msg) {
   return read();
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -7,7 +7,7 @@
 #include "drv_utils.h"
 #include "opt/opt.h"
 
-#include "vxi/vxi.h"
+#include "vxi_client.h"
 
 /*************************************************/
 /*
@@ -17,6 +17,11 @@
 Driver reads answer from the device only if there is a question mark '?'
 in the message.
 
+VXI-11 protocol is implemented in vxi_client.h: binary data is
+supported, long messages are sent in pipelined chunks, requests
+which are not finished in time (or before the request deadline)
+are cancelled with device_abort.
+
 Parameters:
 
 * `-addr <N>`      -- IP/hostname.
@@ -25,15 +30,25 @@ Parameters:
 * `-name <N>`      -- Instrument name ("instr0", "gpib0,10", etc.).
                       Required.
 
-* `-rpc_timeout <float>`  -- I/O timeout in seconds.
+* `-port <N>`      -- Port of the VXI-11 core channel.
+                      Default: 0, get it from the portmapper.
+
+* `-rpc_timeout <float>`  -- RPC timeout in seconds.
                              Default 2.0
 
 * `-io_timeout <float>`   -- I/O timeout in seconds.
-                             Default 5.0
-
-* `-lock_timeout <float>` -- I/O timeout in seconds.
                              Default 2.0
 
+* `-lock_timeout <float>` -- Lock timeout in seconds.
+                             Default 10.0
+
+* `-read_size <N>` -- Max size of data requested by one device_read call.
+                      Default: 1048576
+
+* `-termchar <N>`  -- Code of a termination character for reading
+                      (-1 -- read until END indicator).
+                      Default: -1
+
 * `-errpref <str>` -- Prefix for error messages.
                       Default: "vxi: "
 
@@ -57,12 +72,18 @@ Parameters:
 
 class Driver_vxi: public Driver {
 protected:
-  int dh; // GPIB device handler
   std::string errpref,idn;
   std::string add,trim;
   read_cond_t read_cond;
   double delay;
-  std::shared_ptr<VXI> dev;
+  double rpc_timeout, io_timeout;
+  size_t read_size;
+  int termchar;
+  std::shared_ptr<VXIClient> dev;
+
+  // Set device I/O timeout limited by the request deadline,
+  // return time to wait for a reply.
+  double set_timeout();
 
 public:
 
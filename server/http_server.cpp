@@ -2,9 +2,16 @@
 #include <fstream>
 #include <string>
 #include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <strings.h>
 
 #include "err/err.h"
 #include "http_server.h"
+#include "websocket.h"
 
 #if MHD_VERSION < 0x00097002
 #define MHD_Result int
@@ -21,6 +28,15 @@ AppendToOpt (void *cls,
 }
 
 
+// callback (MHD_UpgradeHandler) for connections upgraded to WebSocket
+void
+WsUpgrade(void *cls, struct MHD_Connection *connection, void *con_cls,
+          const char *extra_in, size_t extra_in_size, MHD_socket sock,
+          struct MHD_UpgradeResponseHandle *urh){
+  ((HTTP_Server*)cls)->ws_start(sock,
+    extra_in_size? std::string(extra_in, extra_in_size): std::string(), urh);
+}
+
 // callback (MHD_AccessHandlerCallback) for processing requests
 MHD_Result
 ProcessRequest(void * cls,
@@ -52,10 +68,27 @@ ProcessRequest(void * cls,
   *ptr = NULL; /* clear context pointer */
 
 
-  DevManager * dm = (DevManager*)cls;
+  HTTP_Server * srv = (HTTP_Server*)cls;
+  DevManager * dm = srv->get_dm();
   struct MHD_Response * response;
   MHD_Result ret;
   try {
+    // switch to WebSocket
+    auto upg = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Upgrade");
+    if (upg && strcasecmp(upg, "websocket") == 0){
+      auto key = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Sec-WebSocket-Key");
+      auto ver = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Sec-WebSocket-Version");
+      if (!key || !ver || strcmp(ver, "13") != 0)
+        throw Err() << "bad websocket request";
+      Log(3) << "conn:" << cnum << " upgrade to websocket";
+      response = MHD_create_response_for_upgrade(&WsUpgrade, srv);
+      MHD_add_response_header(response, MHD_HTTP_HEADER_UPGRADE, "websocket");
+      MHD_add_response_header(response, "Sec-WebSocket-Accept", ws_accept(key).c_str());
+      ret = MHD_queue_response(connection, MHD_HTTP_SWITCHING_PROTOCOLS, response);
+      MHD_destroy_response(response);
+      return ret;
+    }
+
     Opt opts;
     MHD_get_connection_values(connection, MHD_GET_ARGUMENT_KIND, AppendToOpt, &opts);
     Log(3) << "conn:" << cnum << " process request: " << url;
@@ -78,9 +111,6 @@ ProcessRequest(void * cls,
   return ret;
 }
 
-// global connection counter
-uint64_t cmax = 0;
-
 // Callback for opening/closing a connection
 void ConnFunc (void *cls,
                struct MHD_Connection *connection,
@@ -92,7 +122,7 @@ void ConnFunc (void *cls,
   uint64_t cnum;
   switch (toe){
   case MHD_CONNECTION_NOTIFY_STARTED:
-    cnum = cmax++;
+    cnum = dm->conn_open();
     MHD_set_connection_option(connection, MHD_CONNECTION_OPTION_TIMEOUT, 10);
     *socket_context = new uint64_t;
     *(uint64_t*)*socket_context = cnum; // set connection number
@@ -101,15 +131,18 @@ void ConnFunc (void *cls,
     if (Log::get_log_level() >= 2){
       auto info = MHD_get_connection_info(
         connection, MHD_CONNECTION_INFO_CLIENT_ADDRESS);
-      struct sockaddr_in *sa = (sockaddr_in*)info->client_addr;
-      uint32_t a = ntohl(sa->sin_addr.s_addr);
-      //uint16_t p = ntohs(sa->sin_port);
-      Log(2) << "conn:" << cnum << " open connection from "
-             << ((a>>24)&0xff) << "." << ((a>>16)&0xff) << "."
-             << ((a>>8)&0xff) << "." << (a&0xff);
+      if (info->client_addr->sa_family == AF_UNIX){
+        Log(2) << "conn:" << cnum << " open connection from local socket";
+      }
+      else {
+        struct sockaddr_in *sa = (sockaddr_in*)info->client_addr;
+        uint32_t a = ntohl(sa->sin_addr.s_addr);
+        //uint16_t p = ntohs(sa->sin_port);
+        Log(2) << "conn:" << cnum << " open connection from "
+               << ((a>>24)&0xff) << "." << ((a>>16)&0xff) << "."
+               << ((a>>8)&0xff) << "." << (a&0xff);
+      }
     }
-
-    dm->conn_open(cnum);
     break;
   case MHD_CONNECTION_NOTIFY_CLOSED:
     cnum = *(uint64_t*)*socket_context;
@@ -121,6 +154,63 @@ void ConnFunc (void *cls,
 }
 
 HTTP_Server::HTTP_Server(
+      const std::string & addr,
+      const int port,
+      const bool test,
+      DevManager * dm): sock(-1), dm(dm), ws_wake(false), ws_stop(false) {
+  start(addr, port, test, dm);
+}
+
+int
+listen_unix_socket(const std::string & path, const int mode){
+  struct sockaddr_un sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(sa.sun_path))
+    throw Err() << "too long socket path: " << path;
+  strncpy(sa.sun_path, path.c_str(), sizeof(sa.sun_path)-1);
+
+  // remove old socket file
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0){
+    if (!S_ISSOCK(st.st_mode))
+      throw Err() << "file exists and it is not a socket: " << path;
+    unlink(path.c_str());
+  }
+
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0)
+    throw Err() << "can't create socket: " << strerror(errno);
+
+  if (bind(sock, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+      (mode!=0 && chmod(path.c_str(), mode) < 0) ||
+      listen(sock, 32) < 0){
+    auto e = errno;
+    ::close(sock);
+    throw Err() << "can't listen socket " << path << ": " << strerror(e);
+  }
+  return sock;
+}
+
+HTTP_Server::HTTP_Server(
+      const std::string & path,
+      const int mode,
+      DevManager * dm,
+      const bool test): sock(-1), path(path), dm(dm),
+      ws_wake(false), ws_stop(false) {
+
+  sock = listen_unix_socket(path, mode);
+
+  try { start("", 0, test, dm); }
+  catch (Err & e){
+    ::close(sock);
+    unlink(path.c_str());
+    throw;
+  }
+}
+
+void
+HTTP_Server::start(
       const std::string & addr,
       const int port,
       const bool test,
@@ -130,22 +220,28 @@ HTTP_Server::HTTP_Server(
   std::vector<struct MHD_OptionItem> ops;
 
   // server flags
-  int flags = MHD_USE_THREAD_PER_CONNECTION;
+  int flags = MHD_USE_THREAD_PER_CONNECTION | MHD_ALLOW_UPGRADE;
 
   // notifications about opening/closing connections
   ops.push_back((MHD_OptionItem)
     {MHD_OPTION_NOTIFY_CONNECTION, (intptr_t)&ConnFunc, dm});
 
+  // use already opened socket
+  if (sock>=0){
+    ops.push_back((MHD_OptionItem)
+      { MHD_OPTION_LISTEN_SOCKET, sock, NULL });
+  }
+
   // listen only one address
-  struct sockaddr_in sock;
-  if (addr!="*"){
+  struct sockaddr_in sa;
+  if (sock<0 && addr!="*"){
     // fill sockaddr_in structure
-    memset (&sock, 0, sizeof (struct sockaddr_in));
-    sock.sin_family = AF_INET;
-    sock.sin_port = htons(port);
-    sock.sin_addr.s_addr = htonl(str_to_type_ip4(addr));
+    memset (&sa, 0, sizeof (struct sockaddr_in));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(str_to_type_ip4(addr));
     ops.push_back((MHD_OptionItem)
-      { MHD_OPTION_SOCK_ADDR, 0, &sock });
+      { MHD_OPTION_SOCK_ADDR, 0, &sa });
   }
 
   // test mode - only one connection at a time, to
@@ -161,16 +257,80 @@ HTTP_Server::HTTP_Server(
       { MHD_OPTION_END, 0, NULL });
 
   d = MHD_start_daemon(
-      flags, port, NULL, NULL, &ProcessRequest, dm,
+      flags, port, NULL, NULL, &ProcessRequest, this,
       MHD_OPTION_ARRAY, ops.data(),
       MHD_OPTION_END);
 
+  if (d == NULL && sock>=0)
+    throw Err() << "Can't start http server at " << path;
   if (d == NULL)
     throw Err() << "Can't start http server at " << addr << ":" << port;
+
+  ws_thread = std::thread(&HTTP_Server::ws_loop, this);
 }
 
 HTTP_Server::~HTTP_Server(){
-  MHD_stop_daemon((MHD_Daemon*)d);
+  // stop the reaper, close WebSocket sessions
+  {
+    std::lock_guard<std::mutex> lk(ws_mutex);
+    ws_stop = true;
+    for (auto & c:ws_conns) shutdown(c.s->get_fd(), SHUT_RDWR);
+  }
+  ws_cond.notify_all();
+  ws_thread.join();
+  ws_reap(true);
+  MHD_stop_daemon((MHD_Daemon*)d); // listening socket is closed here
+  if (sock>=0) unlink(path.c_str());
+}
+
+void
+HTTP_Server::ws_start(int fd, const std::string & extra_in,
+                      struct MHD_UpgradeResponseHandle * urh){
+  // session uses blocking IO
+  int fl = fcntl(fd, F_GETFL);
+  if (fl>=0) fcntl(fd, F_SETFL, fl & ~O_NONBLOCK);
+
+  WsConn c;
+  c.s.reset(new BinSession(fd, dm, BIN_MAX_WORKERS, true, extra_in));
+  c.urh = urh;
+  Log(2) << "conn:" << c.s->get_conn() << " open websocket session";
+  c.s->on_finish([this]{
+    std::lock_guard<std::mutex> lk(ws_mutex);
+    ws_wake = true;
+    ws_cond.notify_all();
+  });
+  std::lock_guard<std::mutex> lk(ws_mutex);
+  ws_conns.push_back(c);
+  c.s->start();
+}
+
+void
+HTTP_Server::ws_reap(bool all){
+  std::list<WsConn> old;
+  {
+    std::lock_guard<std::mutex> lk(ws_mutex);
+    for (auto i = ws_conns.begin(); i!=ws_conns.end();){
+      if (all || i->s->finished()) { old.push_back(*i); i = ws_conns.erase(i); }
+      else ++i;
+    }
+  }
+  for (auto & c:old){
+    c.s.reset(); // wait for the session threads
+    MHD_upgrade_action(c.urh, MHD_UPGRADE_ACTION_CLOSE);
+  }
+}
+
+void
+HTTP_Server::ws_loop(){
+  std::unique_lock<std::mutex> lk(ws_mutex);
+  while (!ws_stop){
+    ws_cond.wait(lk, [this]{return ws_stop || ws_wake;});
+    if (ws_stop) break;
+    ws_wake = false;
+    lk.unlock();
+    ws_reap(false);
+    lk.lock();
+  }
 }
 
 
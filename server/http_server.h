@@ -2,24 +2,93 @@
 #define HTTP_SERVER_H
 
 #include <microhttpd.h>
+#include <list>
+#include <memory>
+#include <thread>
+#include <condition_variable>
 #include "dev_manager.h"
+#include "bin_server.h"
 
 /*************************************************/
 // Microhttpd-related functions.
 // Requests from users are transferred into DevManager.
 // Each connection in a separate thread.
+// Requests with "Upgrade: websocket" header switch the connection to
+// WebSocket, then binary protocol frames are used (see BinSession).
 
 class HTTP_Server{
   void *d;
+  int sock;         // listening unix socket (or -1)
+  std::string path; // unix socket path
+  DevManager * dm;
 
-public:
+  // WebSocket sessions
+  struct WsConn {
+    std::shared_ptr<BinSession> s;
+    struct MHD_UpgradeResponseHandle * urh;
+  };
+  std::list<WsConn> ws_conns;
+  std::mutex ws_mutex;          // for ws_conns, ws_wake, ws_stop
+  std::condition_variable ws_cond;
+  bool ws_wake;                 // a session has finished
+  bool ws_stop;
+  std::thread ws_thread;        // reaper of finished sessions
+
+  // close finished WebSocket sessions (or all sessions)
+  void ws_reap(bool all);
+
+  // reaper thread: close sessions as soon as they finish
+  void ws_loop();
+
+  // start the daemon (with a listening socket if sock>=0)
+  void start(const std::string & addr, const int port,
+             const bool test, DevManager * dm);
+
+  // Listen TCP port.
   HTTP_Server(
       const std::string & addr,
       const int port,
       bool test, // test mode with single connection
       DevManager * dm);
 
+  // Listen unix domain socket.
+  HTTP_Server(
+      const std::string & path,
+      const int mode,
+      DevManager * dm,
+      bool test);
+
+public:
+  // Listen TCP port.
+  static std::unique_ptr<HTTP_Server> tcp(
+      const std::string & addr,
+      const int port,
+      DevManager * dm,
+      bool test){ // test mode with single connection
+    return std::unique_ptr<HTTP_Server>(new HTTP_Server(addr, port, test, dm));}
+
+  // Listen unix domain socket. If mode is not 0 set permissions of
+  // the socket file. Old socket file is removed if needed.
+  static std::unique_ptr<HTTP_Server> unix_socket(
+      const std::string & path,
+      const int mode,
+      DevManager * dm,
+      bool test){
+    return std::unique_ptr<HTTP_Server>(new HTTP_Server(path, mode, dm, test));}
+
   ~HTTP_Server();
+
+  DevManager * get_dm() const {return dm;}
+
+  // Start a WebSocket session on an upgraded connection
+  // (called by microhttpd).
+  void ws_start(int fd, const std::string & extra_in,
+                struct MHD_UpgradeResponseHandle * urh);
 };
 
+// Create a listening unix domain socket (used also by BinServer).
+// If mode is not 0 set permissions of the socket file.
+// Old socket file is removed if needed.
+int listen_unix_socket(const std::string & path, const int mode);
+
 #endif
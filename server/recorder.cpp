@@ -0,0 +1,382 @@
+#include "recorder.h"
+#include "err/err.h"
+#include "log/log.h"
+
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/*************************************************/
+// helpers
+
+namespace {
+
+// segment/index file name
+std::string
+seg_name(const std::string & dir, const int64_t t0, const char * ext){
+  char n[32];
+  snprintf(n, sizeof(n), "%020lld", (long long)t0);
+  return dir + "/" + n + ext;
+}
+
+void
+write_all(int fd, const char * data, size_t size){
+  size_t n = 0;
+  while (n < size){
+    auto ret = ::write(fd, data+n, size-n);
+    if (ret<0 && errno == EINTR) continue;
+    if (ret<0) throw Err() << "recorder: write error: " << strerror(errno);
+    n += ret;
+  }
+}
+
+// read-only memory map of a file
+struct MMap {
+  const char * data;
+  size_t size;
+  MMap(const std::string & fname): data(NULL), size(0) {
+    int fd = open(fname.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd<0) return;
+    struct stat st;
+    if (fstat(fd, &st)==0 && st.st_size>0){
+      void * p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (p != MAP_FAILED) {data = (const char*)p; size = st.st_size;}
+    }
+    ::close(fd);
+  }
+  ~MMap(){ if (data) munmap((void*)data, size); }
+};
+
+}
+
+/*************************************************/
+
+Recorder::Recorder(const std::string & dir, const size_t seg_size):
+    dir(dir), seg_size(seg_size), nbuf(0), nwrit(0), nwant(0), stop(false),
+    ndropped(0), seg_fd(-1), idx_fd(-1), seg_pos(0), seg_n(0) {
+  if (dir=="") throw Err() << "recorder: empty directory name";
+  if (mkdir(dir.c_str(), 0755)<0 && errno != EEXIST)
+    throw Err() << "recorder: can't create directory: " << dir
+                << ": " << strerror(errno);
+  if (access(dir.c_str(), W_OK)<0)
+    throw Err() << "recorder: can't write to directory: " << dir
+                << ": " << strerror(errno);
+  writer = std::thread(&Recorder::write_loop, this);
+}
+
+Recorder::~Recorder(){
+  {
+    std::lock_guard<std::mutex> lk(buf_mutex);
+    stop = true;
+  }
+  buf_cond.notify_all();
+  writer.join();
+  close_segment();
+}
+
+void
+Recorder::add(const int type, const int64_t t1, const int64_t t2,
+              const std::string & msg, const std::string & ans){
+  char h[REC_HEADER_SIZE];
+  uint32_t len  = REC_HEADER_SIZE + msg.size() + ans.size();
+  uint32_t mlen = msg.size();
+  memset(h, 0, sizeof(h));
+  memcpy(h,    &len, 4);
+  h[4] = type;
+  memcpy(h+8,  &t1, 8);
+  memcpy(h+16, &t2, 8);
+  memcpy(h+24, &mlen, 4);
+
+  std::unique_lock<std::mutex> lk(buf_mutex);
+  if (buf.size() + len > REC_MAX_BUF) {ndropped++; return;}
+  buf.append(h, sizeof(h));
+  buf.append(msg);
+  buf.append(ans);
+  nbuf++;
+  if (buf.size() >= REC_WRITE_SIZE) buf_cond.notify_all();
+}
+
+void
+Recorder::flush(){
+  std::unique_lock<std::mutex> lk(buf_mutex);
+  auto n = nwant = std::max(nwant, nbuf);
+  buf_cond.notify_all();
+  done_cond.wait(lk, [this,n]{return nwrit >= n || stop;});
+}
+
+std::string
+Recorder::error(){
+  std::lock_guard<std::mutex> lk(buf_mutex);
+  return err;
+}
+
+void
+Recorder::write_loop(){
+  std::unique_lock<std::mutex> lk(buf_mutex);
+  while (1){
+    // write data when the buffer is large enough, on flush(),
+    // and at least every 0.5 s
+    buf_cond.wait_for(lk, std::chrono::milliseconds(500), [this]{
+      return stop || buf.size() >= REC_WRITE_SIZE || nwrit < nwant;});
+    if (buf.size()){
+      std::string data;
+      data.swap(buf);
+      auto n = nbuf;
+      lk.unlock();
+      std::string e;
+      try { write_data(data); }
+      catch (Err & ex) { e = ex.str(); }
+      lk.lock();
+      if (e.size()){
+        if (err != e) Log(1) << e;
+        err = e;
+      }
+      nwrit = n;
+    }
+    done_cond.notify_all();
+    if (stop && buf.size()==0) break;
+  }
+}
+
+void
+Recorder::open_segment(const int64_t t0){
+  close_segment();
+  auto fn = seg_name(dir, t0, ".rec");
+  seg_fd = open(fn.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (seg_fd<0) throw Err() << "recorder: can't open file: "
+                            << fn << ": " << strerror(errno);
+  auto fi = seg_name(dir, t0, ".idx");
+  idx_fd = open(fi.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (idx_fd<0) throw Err() << "recorder: can't open file: "
+                            << fi << ": " << strerror(errno);
+  struct stat st;
+  seg_pos = fstat(seg_fd, &st)==0 ? st.st_size : 0;
+  seg_n = 0;
+}
+
+void
+Recorder::close_segment(){
+  if (seg_fd>=0) ::close(seg_fd);
+  if (idx_fd>=0) ::close(idx_fd);
+  seg_fd = idx_fd = -1;
+}
+
+void
+Recorder::write_data(const std::string & data){
+  // Walk through records, write contiguous chunks,
+  // start new segments when needed.
+  size_t b = 0, p = 0; // beginning of the chunk, current record
+  std::string idx;
+  while (p + REC_HEADER_SIZE <= data.size()){
+    uint32_t len;
+    int64_t t2;
+    memcpy(&len, data.data()+p, 4);
+    memcpy(&t2, data.data()+p+16, 8);
+
+    if (seg_fd<0 || (seg_pos>0 && seg_pos + len > seg_size)){
+      if (seg_fd>=0){
+        write_all(seg_fd, data.data()+b, p-b);
+        write_all(idx_fd, idx.data(), idx.size());
+      }
+      idx.clear();
+      b = p;
+      open_segment(t2);
+    }
+    if (seg_n % REC_INDEX_STEP == 0){
+      uint64_t off = seg_pos;
+      idx.append((const char*)&t2, 8);
+      idx.append((const char*)&off, 8);
+    }
+    seg_pos += len;
+    seg_n++;
+    p += len;
+  }
+  write_all(seg_fd, data.data()+b, p-b);
+  write_all(idx_fd, idx.data(), idx.size());
+}
+
+std::vector<Record>
+Recorder::read(const int64_t from, const int64_t to, const size_t limit){
+  std::vector<Record> ret;
+  scan(from, to, [&ret,limit](const Record & r){
+    ret.push_back(r);
+    return !limit || ret.size()<limit;
+  });
+  return ret;
+}
+
+void
+Recorder::scan(const int64_t from, const int64_t to,
+               const std::function<bool(const Record &)> & f){
+  flush();
+
+  // list of segments (sorted by start time)
+  std::vector<int64_t> segs;
+  DIR * d = opendir(dir.c_str());
+  if (!d) throw Err() << "recorder: can't open directory: " << dir
+                      << ": " << strerror(errno);
+  while (auto e = readdir(d)){
+    std::string n(e->d_name);
+    if (n.size()!=24 || n.substr(20)!=".rec") continue;
+    segs.push_back(atoll(n.substr(0,20).c_str()));
+  }
+  closedir(d);
+  std::sort(segs.begin(), segs.end());
+
+  Record r;
+  for (size_t i=0; i<segs.size(); i++){
+    if (segs[i] > to) break;
+    if (i+1<segs.size() && segs[i+1] < from) continue;
+
+    // find start position in the index
+    size_t pos = 0;
+    {
+      MMap idx(seg_name(dir, segs[i], ".idx"));
+      size_t n = idx.size/16;
+      size_t lo = 0, hi = n; // first entry with time >= from
+      while (lo<hi){
+        size_t m = (lo+hi)/2;
+        int64_t t;
+        memcpy(&t, idx.data + 16*m, 8);
+        if (t < from) lo = m+1; else hi = m;
+      }
+      if (lo>0) memcpy(&pos, idx.data + 16*(lo-1) + 8, 8);
+    }
+
+    MMap seg(seg_name(dir, segs[i], ".rec"));
+    while (pos + REC_HEADER_SIZE <= seg.size){
+      uint32_t len, mlen;
+      memcpy(&len,  seg.data+pos, 4);
+      memcpy(&r.t1, seg.data+pos+8, 8);
+      memcpy(&r.t2, seg.data+pos+16, 8);
+      memcpy(&mlen, seg.data+pos+24, 4);
+      if (len < REC_HEADER_SIZE + mlen || pos + len > seg.size) break;
+      if (r.t2 > to) break;
+      if (r.t2 >= from){
+        r.type = seg.data[pos+4];
+        r.msg.assign(seg.data+pos+REC_HEADER_SIZE, mlen);
+        r.ans.assign(seg.data+pos+REC_HEADER_SIZE+mlen, len-REC_HEADER_SIZE-mlen);
+        if (!f(r)) return;
+      }
+      pos += len;
+    }
+  }
+}
+
+/*************************************************/
+
+std::string
+rec_time(const int64_t t){
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%lld.%09lld",
+           (long long)(t/1000000000), (long long)(t%1000000000));
+  return buf;
+}
+
+std::string
+rec_escape(const std::string & s){
+  std::string ret;
+  for (auto c: s){
+    switch (c){
+      case '\t': ret += "\\t"; break;
+      case '\n': ret += "\\n"; break;
+      case '\\': ret += "\\\\"; break;
+      default: ret += c;
+    }
+  }
+  return ret;
+}
+
+bool
+rec_parse_numbers(const std::string & ans, std::vector<double> & vals){
+  vals.clear();
+  const char *s = ans.c_str(), *e = s + ans.size();
+  while (s < e){
+    if (strchr(" \t\r\n,;", *s)) {s++; continue;}
+    char *p;
+    auto v = strtod(s, &p);
+    if (p == s || (p < e && !strchr(" \t\r\n,;", *p))) return false;
+    vals.push_back(v);
+    s = p;
+  }
+  return vals.size()>0;
+}
+
+/*************************************************/
+
+RecAgg::RecAgg(const int64_t bucket, const std::string & agg,
+               const size_t limit): bucket(bucket), limit(limit) {
+  if (bucket <= 0) throw Err() << "bad bucket size: " << bucket;
+  size_t p0 = 0;
+  while (p0 <= agg.size()){
+    auto p1 = agg.find(',', p0);
+    if (p1 == std::string::npos) p1 = agg.size();
+    auto a = agg.substr(p0, p1-p0);
+    if      (a == "min")  aggs.push_back(AGG_MIN);
+    else if (a == "max")  aggs.push_back(AGG_MAX);
+    else if (a == "mean") aggs.push_back(AGG_MEAN);
+    else if (a == "last") aggs.push_back(AGG_LAST);
+    else throw Err() << "unknown aggregate: " << a;
+    p0 = p1+1;
+  }
+}
+
+bool
+RecAgg::add(const int64_t t, const std::string & ans){
+  auto k = t - t%bucket;
+  if (limit && buckets.size() >= limit && buckets.count(k)==0)
+    return k < buckets.rbegin()->first;
+
+  if (!rec_parse_numbers(ans, vals)) return true;
+
+  auto & b = buckets[k];
+  auto n = vals.size();
+  if (b.cnt.size() < n){
+    b.min.resize(n, 0); b.max.resize(n, 0);
+    b.sum.resize(n, 0); b.last.resize(n, 0);
+    b.cnt.resize(n, 0);
+  }
+  b.n++;
+  for (size_t i=0; i<n; i++){
+    auto v = vals[i];
+    if (b.cnt[i]==0 || v < b.min[i]) b.min[i] = v;
+    if (b.cnt[i]==0 || v > b.max[i]) b.max[i] = v;
+    b.sum[i] += v;
+    b.last[i] = v;
+    b.cnt[i]++;
+  }
+  return true;
+}
+
+std::string
+RecAgg::print() const {
+  std::string ret;
+  char buf[32];
+  for (auto const & kb: buckets){
+    auto const & b = kb.second;
+    ret += rec_time(kb.first) + "\t" + std::to_string(b.n);
+    for (size_t i=0; i<b.cnt.size(); i++){
+      for (auto a: aggs){
+        double v = NAN; // column without values
+        if (b.cnt[i]) switch (a){
+          case AGG_MIN:  v = b.min[i]; break;
+          case AGG_MAX:  v = b.max[i]; break;
+          case AGG_MEAN: v = b.sum[i]/b.cnt[i]; break;
+          case AGG_LAST: v = b.last[i]; break;
+        }
+        snprintf(buf, sizeof(buf), "\t%.10g", v);
+        ret += buf;
+      }
+    }
+    ret += "\n";
+  }
+  return ret;
+}
@@ -0,0 +1,166 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
+/*************************************************/
+// Append-only recorder of device traffic (see -record device parameter
+// and history action).
+//
+// Records are added to a memory buffer, a writer thread writes them to
+// segment files with large write() calls, so device requests never wait
+// for the disk. If the buffer grows above REC_MAX_BUF (disk is too slow)
+// new records are dropped and counted.
+//
+// Files in the recorder directory:
+//   <t0>.rec -- segment: records one after another;
+//   <t0>.idx -- time index of the segment: (i64 time, u64 offset) pairs
+//               for every REC_INDEX_STEP-th record.
+// t0 is the time of the first record in the segment (unix ns, 20 digits),
+// a new segment is started when the current one exceeds the segment
+// size, and each time the recorder is created.
+//
+// Record (integers in host byte order):
+//   u32 len    -- size of the record, including this header
+//   u8  type   -- REC_ASK, REC_ERR, REC_POLL
+//   3 bytes    -- unused (zero)
+//   i64 t1, t2 -- send and receive times, unix ns
+//   u32 mlen   -- message length
+//   message (mlen bytes), answer or error message (rest of the record)
+//
+// Readback uses mmap. Records are searched by the receive time t2.
+
+#define REC_HEADER_SIZE 28
+#define REC_INDEX_STEP  256
+#define REC_MAX_BUF     (64<<20)
+#define REC_WRITE_SIZE  (1<<20)
+
+enum RecType {REC_ASK=0, REC_ERR=1, REC_POLL=2};
+
+struct Record {
+  int type;
+  int64_t t1, t2; // unix ns
+  std::string msg, ans;
+};
+
+class Recorder {
+  std::string dir;
+  size_t seg_size;
+
+  // memory buffer (protected by buf_mutex)
+  std::string buf;
+  uint64_t nbuf;    // number of added records
+  uint64_t nwrit;   // number of written records
+  uint64_t nwant;   // number of records flush() waits for
+  bool stop;
+  std::mutex buf_mutex;
+  std::condition_variable buf_cond;  // writer waits for data
+  std::condition_variable done_cond; // flush() waits for writer
+  std::atomic<uint64_t> ndropped;
+
+  // current segment (used only by the writer thread)
+  int seg_fd, idx_fd;
+  size_t seg_pos;   // size of the segment
+  uint64_t seg_n;   // number of records in the segment
+  std::string err;  // last write error
+
+  std::thread writer;
+  void write_loop();
+
+  // Write data with records to segments (writer thread).
+  void write_data(const std::string & data);
+  void open_segment(const int64_t t0);
+  void close_segment();
+
+  Recorder(const Recorder &) = delete;
+  Recorder& operator=(const Recorder &) = delete;
+
+public:
+  // Create the directory if needed, start the writer thread.
+  Recorder(const std::string & dir, const size_t seg_size = 64<<20);
+  ~Recorder();
+
+  // Add a record (does not wait for the disk).
+  void add(const int type, const int64_t t1, const int64_t t2,
+           const std::string & msg, const std::string & ans);
+
+  // Wait until all added records are written.
+  void flush();
+
+  // Read records with receive time in [from, to] (unix ns),
+  // at most limit records (0 -- no limit).
+  std::vector<Record> read(const int64_t from, const int64_t to,
+                           const size_t limit = 0);
+
+  // Same, but call f for each record without collecting them,
+  // stop if f returns false.
+  void scan(const int64_t from, const int64_t to,
+            const std::function<bool(const Record &)> & f);
+
+  // Recorder directory.
+  const std::string & get_dir() const {return dir;}
+
+  // Number of dropped records.
+  uint64_t dropped() const {return ndropped;}
+
+  // Last write error (empty if there were no errors).
+  std::string error();
+};
+
+// Format unix time in ns as seconds with nanosecond precision.
+std::string rec_time(const int64_t t);
+
+// Escape tabs, newlines and backslashes (for tab-separated output).
+std::string rec_escape(const std::string & s);
+
+// Split an answer into numbers (separated by spaces, commas or
+// semicolons). Return false if it is empty or has non-numeric fields.
+bool rec_parse_numbers(const std::string & ans, std::vector<double> & vals);
+
+/*************************************************/
+// Aggregation of numeric answers in time buckets (bucket and agg
+// arguments of history action).
+//
+// Answers are split into numbers (separated by spaces, commas or
+// semicolons), answers with non-numeric fields are skipped. Each column
+// is aggregated separately. Buckets start at multiples of the bucket
+// size (counted from the unix epoch).
+
+enum RecAggType {AGG_MIN, AGG_MAX, AGG_MEAN, AGG_LAST};
+
+class RecAgg {
+  int64_t bucket;         // bucket size, ns
+  size_t limit;           // max number of buckets (0 -- no limit)
+  std::vector<int> aggs;  // aggregates to print
+
+  struct Bucket {
+    size_t n;             // number of records
+    std::vector<double> min, max, sum, last;
+    std::vector<size_t> cnt;
+    Bucket(): n(0) {}
+  };
+  std::map<int64_t, Bucket> buckets;
+  std::vector<double> vals; // values of the current answer
+
+public:
+  // agg -- comma-separated list of min, max, mean, last.
+  RecAgg(const int64_t bucket, const std::string & agg, const size_t limit = 0);
+
+  // Add an answer received at time t (unix ns). Return false if the
+  // bucket limit is reached and all following records can be skipped.
+  bool add(const int64_t t, const std::string & ans);
+
+  // Print one line per bucket: bucket start time, number of records,
+  // aggregates for each column, tab-separated.
+  std::string print() const;
+};
+
+#endif
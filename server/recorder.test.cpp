@@ -0,0 +1,115 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+#include <cstdlib>
+#include <dirent.h>
+#include "recorder.h"
+#include "opt/opt.h"
+#include "err/assert_err.h"
+
+using namespace std;
+
+// number of files with extension ext in the directory
+size_t
+count_files(const string & dir, const string & ext){
+  size_t n = 0;
+  DIR * d = opendir(dir.c_str());
+  while (auto e = readdir(d)){
+    string s(e->d_name);
+    if (s.size()>ext.size() && s.substr(s.size()-ext.size()) == ext) n++;
+  }
+  closedir(d);
+  return n;
+}
+
+int
+main(){
+  char tmpl[] = "/tmp/recorder_test_XXXXXX";
+  string dir = mkdtemp(tmpl);
+  try{
+
+    assert_err(Recorder(""), "recorder: empty directory name");
+
+    {
+      // small segments: 1000 records of 34 bytes, 29 records per segment
+      Recorder r(dir + "/d", 1000);
+      for (int i=0; i<1000; i++)
+        r.add(i%10? REC_ASK: REC_ERR, i*1000000LL, i*1000000LL + 500,
+              "m" + type_to_str(i%10), string("a\0\n", 3) + type_to_str(i%10));
+      assert_eq(r.dropped(), 0);
+
+      auto v = r.read(0, INT64_MAX);
+      assert_eq(v.size(), 1000);
+      assert_eq(count_files(dir + "/d", ".rec"), 35);
+      assert_eq(count_files(dir + "/d", ".idx"), 35);
+      assert_eq(v[0].type, REC_ERR);
+      assert_eq(v[1].type, REC_ASK);
+      assert_eq(v[1].msg, "m1");
+      assert_eq(v[1].ans, string("a\0\n1", 4));
+      assert_eq(v[999].t1, 999000000LL);
+      assert_eq(v[999].t2, 999000500LL);
+
+      // time ranges (by receive time)
+      v = r.read(100000500LL, 200000500LL);
+      assert_eq(v.size(), 101);
+      assert_eq(v[0].t2, 100000500LL);
+      v = r.read(100000501LL, 200000499LL);
+      assert_eq(v.size(), 99);
+      assert_eq(r.read(2000000000LL, INT64_MAX).size(), 0);
+      assert_eq(r.read(0, 5000000LL, 3).size(), 3);
+      assert_eq(r.error(), "");
+    }
+
+    // new recorder in the same directory starts a new segment
+    {
+      Recorder r(dir + "/d");
+      r.add(REC_POLL, 2000000000LL, 2000000001LL, "p", "1");
+      auto v = r.read(0, INT64_MAX);
+      assert_eq(v.size(), 1001);
+      assert_eq(v[1000].type, REC_POLL);
+      assert_eq(count_files(dir + "/d", ".rec"), 36);
+
+      // large segments: many records are written by one write() call
+      for (int i=0; i<100000; i++)
+        r.add(REC_ASK, 3000000000LL + i, 3000000000LL + i, "q", "v");
+      v = r.read(3000000000LL + 50000, 3000000000LL + 50009);
+      assert_eq(v.size(), 10);
+      assert_eq(v[0].t2, 3000000000LL + 50000);
+    }
+
+    // aggregation
+    assert_err(RecAgg(0, "mean"), "bad bucket size: 0");
+    assert_err(RecAgg(10, "min,avg"), "unknown aggregate: avg");
+    {
+      RecAgg a(1000, "min,max,mean,last");
+      a.add(2500, "1 10");
+      a.add(2100, "3,20");
+      a.add(2900, "text");  // skipped
+      a.add(2950, "");      // skipped
+      a.add(5000, "-1;2;7");
+      a.add(5999, "4.5");
+      assert_eq(a.print(),
+        "0.000002000\t2\t1\t3\t2\t3\t10\t20\t15\t20\n"
+        "0.000005000\t2\t-1\t4.5\t1.75\t4.5\t2\t2\t2\t2\t7\t7\t7\t7\n");
+    }
+    {
+      // limit on the number of buckets
+      RecAgg a(1000, "last", 2);
+      assert_eq(a.add(1000, "1"), true);
+      assert_eq(a.add(2000, "2"), true);
+      assert_eq(a.add(2500, "3"), true);
+      assert_eq(a.add(3000, "4"), false);
+      assert_eq(a.print(), "0.000001000\t1\t1\n0.000002000\t2\t3\n");
+    }
+    assert_eq(rec_time(1601284005012345678LL), "1601284005.012345678");
+
+  }
+  catch (Err e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    system(("rm -rf " + dir).c_str());
+    return 1;
+  }
+  system(("rm -rf " + dir).c_str());
+  return 0;
+}
+
+///\endcond
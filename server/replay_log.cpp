@@ -0,0 +1,100 @@
+#include <map>
+#include <cstdlib>
+#include "err/err.h"
+#include "dev_manager.h"
+#include "replay_log.h"
+
+// Split optional timestamp from a device log line.
+// Return -1 if there is no timestamp.
+static double
+split_time(std::string & l){
+  size_t n = l.find(' ');
+  if (n == std::string::npos || n == 0) return -1;
+  const char *b = l.c_str();
+  char *e;
+  double t = strtod(b, &e);
+  if (e != b+n) return -1;
+  l = l.substr(n+1);
+  return t;
+}
+
+std::vector<ReplayRec>
+read_replay_log(std::istream & s, const std::string & dev){
+  std::vector<ReplayRec> ret;
+
+  // server log: requests waiting for answers, conn -> record
+  std::map<std::string, ReplayRec> pending;
+
+  // record for continuation lines (multi-line answers), -1 if none
+  int cont = -1;
+
+  // is it a server log?
+  bool srv = false;
+
+  std::string l;
+  int line_num = 0;
+  while (std::getline(s, l)){
+    line_num++;
+
+    // server log
+    if (l.compare(0,5,"conn:") == 0){
+      srv = true;
+      cont = -1;
+      size_t n = l.find(' ');
+      if (n == std::string::npos) continue;
+      std::string conn = l.substr(5, n-5);
+      std::string rest = l.substr(n+1);
+
+      if (rest.compare(0,17,"process request: ") == 0){
+        auto vs = DevManager::parse_url(rest.substr(17));
+        if (vs[0] != "ask" || (dev!="" && vs[1]!=dev)) continue;
+        ReplayRec r;
+        r.msg = vs[2];
+        pending[conn] = r;
+        continue;
+      }
+      if (pending.count(conn)==0) continue;
+      bool err = rest.compare(0,7,"error: ") == 0;
+      if (err || rest.compare(0,8,"answer: ") == 0){
+        ReplayRec & r = pending[conn];
+        r.err = err;
+        r.ans = rest.substr(err? 7:8);
+        ret.push_back(r);
+        pending.erase(conn);
+        cont = ret.size()-1;
+      }
+      continue;
+    }
+
+    // device log
+    std::string l0 = l;
+    double t = split_time(l);
+    std::string pref = l.substr(0,3);
+    if (pref == ">> "){
+      ReplayRec r;
+      r.t = t;
+      r.msg = l.substr(3);
+      ret.push_back(r);
+      cont = -1;
+      continue;
+    }
+    if (pref == "<< " || pref == "EE "){
+      if (ret.size()==0) throw Err() << "replay log, line "
+        << line_num << ": answer without a message";
+      ret.back().err = (pref == "EE ");
+      ret.back().ans = l.substr(3);
+      cont = ret.size()-1;
+      continue;
+    }
+    if (cont>=0) {
+      ret[cont].ans += "\n" + l0;
+      continue;
+    }
+    // skip empty lines, non-request lines of the server log
+    // and headers before the first record
+    if (l0 == "" || srv || ret.empty()) continue;
+    throw Err() << "replay log, line " << line_num
+                << ": unknown line format: " << l0;
+  }
+  return ret;
+}
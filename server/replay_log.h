@@ -0,0 +1,38 @@
+#ifndef REPLAY_LOG_H
+#define REPLAY_LOG_H
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+/*************************************************/
+// Reading recorded device conversations for replaying them
+// through device drivers (see device_replay program).
+//
+// Two formats are supported:
+//
+// * Device log, as returned by `log_get` action (or printed by
+//   `device_c monitor`): lines starting with ">> " (message sent to the
+//   device), "<< " (answer) and "EE " (error). Lines without a prefix
+//   are continuation of a multi-line answer. Each line can be prefixed by
+//   a timestamp (unix seconds, floating point), e.g. by piping the
+//   monitor output through `ts %.s`.
+//
+// * Server log (verbosity level 3): "conn:<N> process request: /ask/<dev>/<msg>",
+//   "conn:<N> answer: <ans>", "conn:<N> error: <err>". Requests and
+//   answers are matched by connection number, non-ask requests are skipped.
+//   If `dev` is not empty only requests to this device are used.
+
+struct ReplayRec {
+  double t;        // timestamp (unix seconds), -1 if unknown
+  std::string msg; // message sent to the device
+  std::string ans; // answer or error message
+  bool err;        // true if the device returned an error
+  ReplayRec(): t(-1), err(false) {}
+};
+
+// Read a log in one of the supported formats (autodetected).
+std::vector<ReplayRec> read_replay_log(std::istream & s,
+  const std::string & dev = "");
+
+#endif
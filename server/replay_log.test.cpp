@@ -0,0 +1,79 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+#include <fstream>
+#include <sstream>
+#include "replay_log.h"
+#include "err/assert_err.h"
+
+using namespace std;
+
+int
+main(){
+  try{
+
+    // device log with timestamps and a multi-line answer
+    {
+      ifstream f("test_data/replay1.txt");
+      auto v = read_replay_log(f);
+      assert_eq(v.size(), 4);
+      assert_eq(v[0].msg, "*IDN?");
+      assert_eq(v[0].ans, "Agilent,34401A,0,1.0");
+      assert_feq(v[0].t, 1601282446.1, 1e-6);
+      assert_eq(v[1].msg, "VOLT 1.0");
+      assert_eq(v[1].ans, "");
+      assert_eq(v[2].ans, "1.000\n2.000");
+      assert_eq(v[2].err, false);
+      assert_eq(v[3].msg, "SYST:ERR?");
+      assert_eq(v[3].ans, "read timeout");
+      assert_eq(v[3].err, true);
+    }
+
+    // device log without timestamps
+    {
+      istringstream s(">> a\n<< b\n>> c d\n<< c d\n");
+      auto v = read_replay_log(s);
+      assert_eq(v.size(), 2);
+      assert_eq(v[0].t, -1);
+      assert_eq(v[1].msg, "c d");
+      assert_eq(v[1].ans, "c d");
+    }
+
+    {
+      istringstream s("<< b\n");
+      assert_err(read_replay_log(s),
+        "replay log, line 1: answer without a message");
+    }
+
+    {
+      istringstream s(">> a\nabc\n");
+      assert_err(read_replay_log(s),
+        "replay log, line 2: unknown line format: abc");
+    }
+
+    // server log
+    {
+      ifstream f("test_data/log2.txt");
+      auto v = read_replay_log(f);
+      assert_eq(v.size(), 8);
+      assert_eq(v[0].msg, "text");
+      assert_eq(v[0].ans, "unknown device: x");
+      assert_eq(v[0].err, true);
+      assert_eq(v[5].msg, "d/e");
+      assert_eq(v[5].ans, "d/e");
+
+      f.clear(); f.seekg(0);
+      v = read_replay_log(f, "b");
+      assert_eq(v.size(), 7);
+      assert_eq(v[6].msg, "123");
+      assert_eq(v[6].ans, "123");
+    }
+
+  }
+  catch (Err e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
@@ -0,0 +1,150 @@
+#include "spp_proc.h"
+#include "err/err.h"
+
+#include <cstring>
+#include <chrono>
+#include <cmath>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+std::vector<std::string>
+spp_argv(const std::string & prog){
+  std::vector<std::string> ret;
+  if (prog.find_first_of("|&;<>()$`\\\"'*?[]{}#~=%!\n") != std::string::npos)
+    return ret;
+  size_t b = 0;
+  while ((b = prog.find_first_not_of(" \t", b)) != std::string::npos){
+    auto e = prog.find_first_of(" \t", b);
+    ret.push_back(prog.substr(b, e==std::string::npos? e: e-b));
+    b = e;
+  }
+  return ret;
+}
+
+SppProc::SppProc(const std::string & prog): pid(0), fdi(-1), fdo(-1){
+  int p1[2], p2[2];
+  if (pipe2(p1, O_CLOEXEC)<0) throw Err() << "pipe error: " << strerror(errno);
+  if (pipe2(p2, O_CLOEXEC)<0){
+    auto e = errno;
+    ::close(p1[0]); ::close(p1[1]);
+    throw Err() << "pipe error: " << strerror(e);
+  }
+
+  signal(SIGPIPE, SIG_IGN); // write errors are reported by write()
+
+  // child: pipes as stdin/stdout, default SIGPIPE handler,
+  // no blocked signals
+  posix_spawn_file_actions_t fa;
+  posix_spawn_file_actions_init(&fa);
+  posix_spawn_file_actions_adddup2(&fa, p1[0], STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&fa, p2[1], STDOUT_FILENO);
+  posix_spawnattr_t sa;
+  posix_spawnattr_init(&sa);
+  sigset_t s;
+  sigemptyset(&s);
+  posix_spawnattr_setsigmask(&sa, &s);
+  sigaddset(&s, SIGPIPE);
+  posix_spawnattr_setsigdefault(&sa, &s);
+  posix_spawnattr_setflags(&sa, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+  // run the program directly or via shell
+  auto words = spp_argv(prog);
+  bool shell = words.empty();
+  if (shell) words = {"sh", "-c", prog};
+  std::vector<char*> argv;
+  for (auto & w: words) argv.push_back((char*)w.c_str());
+  argv.push_back(NULL);
+  int res = shell?
+    posix_spawn(&pid, "/bin/sh", &fa, &sa, argv.data(), environ) :
+    posix_spawnp(&pid, argv[0], &fa, &sa, argv.data(), environ);
+
+  posix_spawn_file_actions_destroy(&fa);
+  posix_spawnattr_destroy(&sa);
+  ::close(p1[0]);
+  ::close(p2[1]);
+  if (res != 0){
+    pid = 0;
+    ::close(p1[1]);
+    ::close(p2[0]);
+    throw Err() << "can't run " << prog << ": " << strerror(res);
+  }
+  fdi = p1[1];
+  fdo = p2[0];
+}
+
+SppProc::~SppProc(){
+  close_input();
+  if (pid) waitpid(pid, NULL, 0);
+  ::close(fdo);
+}
+
+void
+SppProc::write(const std::string & data){
+  if (fdi<0) throw Err() << "write error: input is closed";
+  size_t n = 0;
+  while (n < data.size()){
+    auto ret = ::write(fdi, data.data()+n, data.size()-n);
+    if (ret<0 && errno == EINTR) continue;
+    if (ret<0) throw Err() << "write error: " << strerror(errno);
+    n += ret;
+  }
+}
+
+int
+SppProc::getline(std::string & l, double timeout){
+  auto t_end = std::chrono::steady_clock::now() +
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(timeout));
+  while (1) {
+    auto n = buf.find('\n');
+    if (n != std::string::npos){
+      l = buf.substr(0, n);
+      buf.erase(0, n+1);
+      return l.size();
+    }
+
+    int ms = -1;
+    if (timeout > 0){
+      auto dt = t_end - std::chrono::steady_clock::now();
+      ms = dt.count()>0 ?
+        std::chrono::duration_cast<std::chrono::milliseconds>(dt).count() + 1 : 0;
+    }
+    struct pollfd p = {fdo, POLLIN, 0};
+    int res = poll(&p, 1, ms);
+    if (res < 0 && errno == EINTR) continue;
+    if (res < 0) throw Err() << "read error: " << strerror(errno);
+    if (res == 0) throw Err() << "Read timeout";
+
+    char tmp[4096];
+    auto nr = ::read(fdo, tmp, sizeof(tmp));
+    if (nr < 0 && errno == EINTR) continue;
+    if (nr < 0) throw Err() << "read error: " << strerror(errno);
+    if (nr == 0) { l.clear(); return -1; } // EOF
+    buf.append(tmp, nr);
+  }
+}
+
+void
+SppProc::close_input(){
+  if (fdi<0) return;
+  ::close(fdi);
+  fdi = -1;
+}
+
+void
+SppProc::term(double sec){
+  if (!pid) return;
+  double dt = 0.02;
+  for (int i=0; i<rint(sec/dt); ++i) {
+    if (waitpid(pid, NULL, WNOHANG) == pid) { pid = 0; return; }
+    usleep(rint(1e6*dt));
+  }
+  ::kill(pid, SIGTERM);
+}
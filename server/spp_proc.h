@@ -0,0 +1,47 @@
+#ifndef SPP_PROC_H
+#define SPP_PROC_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+/*************************************************/
+// A program with stdin/stdout attached to pipes (used by the spp
+// driver). It is started with posix_spawn, without a shell if the
+// command line is a plain list of words. Pipes are not inherited by
+// other programs started by the server.
+
+// Split a command line into words if it does not need a shell
+// (no quotes, variables, redirections, etc.), return empty vector
+// otherwise.
+std::vector<std::string> spp_argv(const std::string & prog);
+
+class SppProc {
+  pid_t pid;
+  int fdi, fdo; // stdin and stdout of the program
+  std::string buf; // data read after the last line
+
+public:
+  // Start the program. Throw Err if it can not be started.
+  SppProc(const std::string & prog);
+
+  // Close pipes, wait for the program to exit.
+  ~SppProc();
+
+  // Write data to the program. Throw Err on errors.
+  void write(const std::string & data);
+
+  // Read a line with timeout (<=0 for no timeout), without newline
+  // character. Return line length or -1 on EOF. Throw Err
+  // on errors and timeout.
+  int getline(std::string & l, double timeout);
+
+  // Close stdin of the program.
+  void close_input();
+
+  // Wait for the program to exit up to sec seconds,
+  // then send SIGTERM to it.
+  void term(double sec = 0);
+};
+
+#endif
@@ -0,0 +1,68 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+#include <cassert>
+#include "spp_proc.h"
+#include "err/assert_err.h"
+
+using namespace std;
+
+int
+main(){
+  try{
+
+    assert_eq(spp_argv("prog").size(), 1);
+    assert(spp_argv("  prog -i  a\tb ") ==
+      vector<string>({"prog", "-i", "a", "b"}));
+    assert_eq(spp_argv("").size(), 0);
+    assert_eq(spp_argv("echo 'a b'").size(), 0);
+    assert_eq(spp_argv("prog > file").size(), 0);
+    assert_eq(spp_argv("A=1 prog").size(), 0);
+    assert_eq(spp_argv("echo $HOME").size(), 0);
+
+    assert_err(SppProc("no_such_program_ab34"),
+      "can't run no_such_program_ab34: No such file or directory");
+
+    {
+      SppProc p("cat");
+      string l;
+      p.write("abc\nde");
+      assert_eq(p.getline(l, 1), 3);
+      assert_eq(l, "abc");
+      assert_err(p.getline(l, 0.1), "Read timeout");
+      p.write("f\n\n");
+      assert_eq(p.getline(l, 1), 3);
+      assert_eq(l, "def");
+      assert_eq(p.getline(l, 1), 0);
+      assert_eq(l, "");
+      p.close_input();
+      assert_eq(p.getline(l, 1), -1);
+      assert_err(p.write("a"), "write error: input is closed");
+    }
+
+    // via shell
+    {
+      SppProc p("echo $((1+2)); echo a | tr a b");
+      string l;
+      assert_eq(p.getline(l, 1), 1);
+      assert_eq(l, "3");
+      assert_eq(p.getline(l, 1), 1);
+      assert_eq(l, "b");
+      assert_eq(p.getline(l, 1), -1);
+    }
+
+    // program which does not exit after closing the input
+    {
+      SppProc p("sleep 10");
+      p.close_input();
+      p.term(0.1);
+    }
+
+  }
+  catch (Err e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
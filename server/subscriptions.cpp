@@ -0,0 +1,246 @@
+#include "subscriptions.h"
+#include "recorder.h" // rec_time, rec_escape, rec_parse_numbers
+#include "err/err.h"
+
+#include <cmath>
+#include <sstream>
+#include <algorithm>
+
+/*************************************************/
+
+Subscriptions::Subscriptions(const poll_fn_t & poll_fn,
+                             const release_fn_t & release_fn):
+  poll_fn(poll_fn), release_fn(release_fn), next_id(1),
+  ndropped(0), stop(false) {}
+
+Subscriptions::~Subscriptions(){
+  {
+    std::lock_guard<std::mutex> lk(m);
+    stop = true;
+    for (auto & p: polls) {
+      p.second->stop = true;
+      old_polls.push_back(p.second);
+    }
+    polls.clear();
+  }
+  poll_cond.notify_all();
+  upd_cond.notify_all();
+  for (auto & p: old_polls) p->thr.join();
+}
+
+uint64_t
+Subscriptions::add(const uint64_t conn, const std::string & dev,
+    const std::string & msg, const double period,
+    const double deadband, const double rel){
+  if (period <= 0) throw Err() << "bad period: " << period;
+  if (deadband < 0) throw Err() << "bad deadband: " << deadband;
+  if (rel < 0) throw Err() << "bad relative deadband: " << rel;
+  reap();
+
+  std::lock_guard<std::mutex> lk(m);
+  std::ostringstream key;
+  key << dev << '\n' << msg << '\n' << period;
+
+  auto id = next_id++;
+  auto & s = subs[id];
+  s.conn = conn;
+  s.poll = key.str();
+  s.deadband = deadband;
+  s.rel = rel;
+  s.sent = s.err = false;
+  queues[conn]; // updates can be waited for
+
+  auto & p = polls[key.str()];
+  if (!p){
+    p.reset(new Poll);
+    p->dev = dev;
+    p->msg = msg;
+    p->period = period;
+    p->thr = std::thread(&Subscriptions::poll_loop, this, p);
+  }
+  p->subs.insert(id);
+
+  // new subscribers of a running poll get its last value
+  if (p->has_last){
+    std::vector<double> vals;
+    bool num = !p->last_err && rec_parse_numbers(p->last, vals);
+    if (update(id, s, p->last, p->last_err, vals, num, p->last_time))
+      upd_cond.notify_all();
+  }
+  return id;
+}
+
+void
+Subscriptions::remove_sub(const uint64_t id){
+  auto i = subs.find(id);
+  if (i == subs.end()) return;
+  auto pi = polls.find(i->second.poll);
+  if (pi != polls.end()){
+    pi->second->subs.erase(id);
+    if (pi->second->subs.empty()){
+      pi->second->stop = true;
+      old_polls.push_back(pi->second);
+      polls.erase(pi);
+      poll_cond.notify_all();
+    }
+  }
+  subs.erase(i);
+}
+
+void
+Subscriptions::remove(const uint64_t conn, const uint64_t id){
+  {
+    std::lock_guard<std::mutex> lk(m);
+    auto i = subs.find(id);
+    if (i == subs.end() || i->second.conn != conn)
+      throw Err() << "unknown subscription: " << id;
+    remove_sub(id);
+  }
+  reap();
+}
+
+void
+Subscriptions::remove_conn(const uint64_t conn){
+  {
+    std::lock_guard<std::mutex> lk(m);
+    if (queues.erase(conn) == 0) return;
+    std::vector<uint64_t> ids;
+    for (auto const & s: subs)
+      if (s.second.conn == conn) ids.push_back(s.first);
+    for (auto id: ids) remove_sub(id);
+  }
+  upd_cond.notify_all();
+  reap();
+}
+
+void
+Subscriptions::reap(){
+  std::list<std::shared_ptr<Poll> > fin;
+  {
+    std::lock_guard<std::mutex> lk(m);
+    for (auto i = old_polls.begin(); i!=old_polls.end();){
+      if ((*i)->done) { fin.push_back(*i); i = old_polls.erase(i); }
+      else ++i;
+    }
+  }
+  for (auto & p: fin) p->thr.join();
+}
+
+std::string
+Subscriptions::wait(const uint64_t conn, const double timeout){
+  std::unique_lock<std::mutex> lk(m);
+  auto ready = [this,conn]{
+    auto i = queues.find(conn);
+    return stop || i == queues.end() || i->second.size(); };
+  if (timeout>0)
+    upd_cond.wait_for(lk, std::chrono::duration<double>(timeout), ready);
+
+  auto i = queues.find(conn);
+  if (i == queues.end()) throw Err() << "no subscriptions";
+  std::string ret;
+  for (auto const & l: i->second) ret += l;
+  i->second.clear();
+
+  // no more updates will come
+  bool any = false;
+  for (auto const & s: subs) if (s.second.conn == conn) {any = true; break;}
+  if (!any) queues.erase(i);
+  return ret;
+}
+
+std::string
+Subscriptions::list(){
+  std::lock_guard<std::mutex> lk(m);
+  std::ostringstream ss;
+  for (auto const & p: polls)
+    ss << p.second->dev << "\t" << rec_escape(p.second->msg) << "\t"
+       << p.second->period << "\t" << p.second->subs.size() << "\t"
+       << p.second->npolls << "\n";
+  if (ndropped) ss << "dropped updates: " << ndropped << "\n";
+  return ss.str();
+}
+
+/*************************************************/
+
+bool
+Subscriptions::update(const uint64_t id, Sub & s, const std::string & ans,
+    const bool err, const std::vector<double> & vals, const bool num,
+    const std::string & time){
+
+  bool changed = !s.sent || s.err != err;
+  if (!changed && (err || !num || s.vals.size() != vals.size()))
+    changed = ans != s.last;
+  else if (!changed){
+    for (size_t i=0; i<vals.size(); i++){
+      double d = fabs(vals[i] - s.vals[i]);
+      if (d > s.deadband && d > s.rel*fabs(s.vals[i])) {changed = true; break;}
+    }
+  }
+  if (!changed) return false;
+
+  s.sent = true;
+  s.err  = err;
+  s.last = ans;
+  if (num) s.vals = vals;
+  else s.vals.clear();
+
+  auto & q = queues[s.conn];
+  q.push_back(std::to_string(id) + "\t" + time + "\t" +
+              (err? "err\t":"val\t") + rec_escape(ans) + "\n");
+  if (q.size() > SUB_MAX_QUEUE) {q.pop_front(); ndropped++;}
+  return true;
+}
+
+void
+Subscriptions::poll_loop(std::shared_ptr<Poll> p){
+  auto period = std::chrono::duration_cast<Driver::clock::duration>(
+                  std::chrono::duration<double>(p->period));
+  auto dl = std::chrono::duration_cast<Driver::clock::duration>(
+              std::chrono::duration<double>(std::max(p->period, SUB_MIN_DEADLINE)));
+  auto next = Driver::clock::now();
+
+  std::unique_lock<std::mutex> lk(m);
+  while (!p->stop){
+    lk.unlock();
+    Driver::Times ts;
+    std::string ans;
+    bool err = false;
+    try {
+      ans = poll_fn(p->dev, p->msg, Driver::clock::now() + dl, ts);
+    }
+    catch (Err & e){
+      ans = e.str();
+      err = true;
+    }
+    if (ts.recv.empty()) ts.recv.set();
+    auto time = rec_time(ts.recv.rt.tv_sec*1000000000LL + ts.recv.rt.tv_nsec);
+    std::vector<double> vals;
+    bool num = !err && rec_parse_numbers(ans, vals);
+    lk.lock();
+
+    p->npolls++;
+    p->has_last  = true;
+    p->last_err  = err;
+    p->last      = ans;
+    p->last_time = time;
+    bool upd = false;
+    for (auto id: p->subs)
+      upd = update(id, subs[id], ans, err, vals, num, time) || upd;
+    if (upd) upd_cond.notify_all();
+
+    // skip polls which are already late
+    next += period;
+    auto now = Driver::clock::now();
+    if (next < now) next = now;
+    poll_cond.wait_until(lk, next, [p]{return p->stop;});
+  }
+
+  // release the device if it is not used by other polls
+  bool used = false;
+  for (auto const & q: polls)
+    if (q.second->dev == p->dev) {used = true; break;}
+  lk.unlock();
+  if (!used) release_fn(p->dev);
+  lk.lock();
+  p->done = true;
+}
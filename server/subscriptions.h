@@ -0,0 +1,128 @@
+#ifndef SUBSCRIPTIONS_H
+#define SUBSCRIPTIONS_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "drv.h"
+
+/*************************************************/
+// Change-driven subscriptions (subscribe, unsubscribe, updates actions).
+//
+// A subscription is a device, a message, a poll period and a deadband.
+// Subscriptions with the same device, message and period share one poll:
+// a thread sends the message every period and compares the answer with
+// the last value sent to each subscriber. Changed values are queued for
+// the subscriber's connection and returned by wait().
+//
+// A numeric answer (see rec_parse_numbers()) is changed if for some of
+// its numbers |v - v0| > deadband and |v - v0| > rel*|v0|, where v0 is
+// the last sent value. Other answers are changed if they differ from the
+// last sent one. Errors are sent when they appear or change.
+//
+// Update lines: <id>\t<receive time>\t(val|err)\t<answer or error>,
+// tabs, newlines and backslashes in answers are escaped.
+
+// max number of queued updates per connection (old ones are dropped)
+#define SUB_MAX_QUEUE 10000
+
+// deadline of poll requests: max(period, SUB_MIN_DEADLINE), s
+#define SUB_MIN_DEADLINE 5.0
+
+class Subscriptions {
+public:
+  // Send a message to a device, write send/receive times to ts.
+  typedef std::function<std::string(const std::string & dev,
+    const std::string & msg, const Driver::clock::time_point & deadline,
+    Driver::Times & ts)> poll_fn_t;
+
+  // Called when the last poll of a device is stopped.
+  typedef std::function<void(const std::string & dev)> release_fn_t;
+
+private:
+  struct Sub {
+    uint64_t conn;
+    std::string poll;          // poll key
+    double deadband, rel;
+    bool sent, err;            // was anything sent, was it an error
+    std::string last;          // last sent answer or error
+    std::vector<double> vals;  // numbers of the last sent answer
+  };
+
+  struct Poll {
+    std::string dev, msg;
+    double period;
+    std::set<uint64_t> subs;   // subscription IDs
+    uint64_t npolls;           // number of polls
+    bool has_last, last_err;   // last answer (for new subscribers)
+    std::string last, last_time;
+    bool stop, done;
+    std::thread thr;
+    Poll(): period(0), npolls(0), has_last(false), last_err(false),
+            stop(false), done(false) {}
+  };
+
+  poll_fn_t poll_fn;
+  release_fn_t release_fn;
+
+  uint64_t next_id;
+  std::map<uint64_t, Sub> subs;                        // id -> subscription
+  std::map<std::string, std::shared_ptr<Poll> > polls; // key -> poll
+  std::list<std::shared_ptr<Poll> > old_polls;         // stopped polls
+  std::map<uint64_t, std::deque<std::string> > queues; // conn -> updates
+  uint64_t ndropped;                                   // dropped updates
+  bool stop;
+
+  std::mutex m;
+  std::condition_variable poll_cond; // poll threads wait for the next poll
+  std::condition_variable upd_cond;  // wait() waits for updates
+
+  void poll_loop(std::shared_ptr<Poll> p);
+
+  // Remove a subscription, stop the poll if it is not used (m locked).
+  void remove_sub(const uint64_t id);
+
+  // Queue an update for a subscriber if the value changed (m locked).
+  // Return true if the update was queued.
+  bool update(const uint64_t id, Sub & s, const std::string & ans,
+              const bool err, const std::vector<double> & vals,
+              const bool num, const std::string & time);
+
+  // Join finished poll threads.
+  void reap();
+
+public:
+  Subscriptions(const poll_fn_t & poll_fn, const release_fn_t & release_fn);
+  ~Subscriptions();
+
+  // Add a subscription for a connection, return its ID.
+  uint64_t add(const uint64_t conn, const std::string & dev,
+    const std::string & msg, const double period,
+    const double deadband = 0, const double rel = 0);
+
+  // Remove a subscription of the connection. Throw Err if there
+  // is no such subscription.
+  void remove(const uint64_t conn, const uint64_t id);
+
+  // Remove all subscriptions and updates of the connection.
+  void remove_conn(const uint64_t conn);
+
+  // Wait for updates of the connection (at most timeout seconds),
+  // return all queued update lines. Throw Err if the connection has
+  // no subscriptions and no updates.
+  std::string wait(const uint64_t conn, const double timeout);
+
+  // List polls: <device>\t<message>\t<period>\t<subscribers>\t<polls> lines.
+  std::string list();
+};
+
+#endif
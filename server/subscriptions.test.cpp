@@ -0,0 +1,117 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+#include <atomic>
+#include <algorithm>
+#include <unistd.h>
+#include "subscriptions.h"
+#include "err/assert_err.h"
+
+using namespace std;
+
+// remove time field from update lines
+string
+no_time(const string & s){
+  string ret;
+  size_t b = 0, e;
+  while ((e = s.find('\n', b)) != string::npos){
+    auto l = s.substr(b, e-b);
+    auto t1 = l.find('\t'), t2 = l.find('\t', t1+1);
+    ret += l.substr(0, t1) + l.substr(t2) + "\n";
+    b = e+1;
+  }
+  return ret;
+}
+
+// collect updates until n lines are received
+string
+get_lines(Subscriptions & s, const uint64_t conn, const size_t n){
+  string ret;
+  for (int i=0; i<500 && count(ret.begin(), ret.end(), '\n') < (int)n; i++)
+    ret += s.wait(conn, 0.01);
+  return no_time(ret);
+}
+
+int
+main(){
+  try{
+    // answer sequences for messages (the last answer is repeated)
+    map<string, vector<string> > seq = {
+      {"v", {"1.0", "1.05", "1.2", "1.2", "2", "abc", "#err1", "#err1", "3"}},
+      {"w", {"10", "14", "16", "30"}},
+    };
+    map<string, size_t> cnt;
+    atomic<bool> go(false);
+    atomic<int> nrel(0);
+    std::mutex m;
+
+    auto poll = [&](const string & dev, const string & msg,
+                    const Driver::clock::time_point & deadline,
+                    Driver::Times & ts){
+      while (!go) usleep(1000);
+      std::lock_guard<std::mutex> lk(m);
+      auto & s = seq[msg];
+      auto a = s[min(cnt[msg]++, s.size()-1)];
+      if (a[0] == '#') throw Err() << a.substr(1);
+      return a;
+    };
+
+    {
+      Subscriptions s(poll, [&](const string & dev){ nrel++; });
+
+      assert_err(s.add(1, "dev", "v", 0), "bad period: 0");
+      assert_err(s.add(1, "dev", "v", 1, -1), "bad deadband: -1");
+      assert_err(s.add(1, "dev", "v", 1, 0, -1), "bad relative deadband: -1");
+      assert_err(s.wait(1, 0), "no subscriptions");
+
+      // two subscribers share one poll
+      auto a = s.add(1, "dev", "v", 0.01, 0.1);
+      auto b = s.add(2, "dev", "v", 0.01);
+      auto c = s.add(3, "dev", "w", 0.01, 0, 0.5);
+      assert_eq(a, 1);
+      assert_eq(b, 2);
+      assert_eq(c, 3);
+      assert_eq(s.list(), "dev\tv\t0.01\t2\t0\ndev\tw\t0.01\t1\t0\n");
+      go = true;
+
+      assert_eq(get_lines(s, 1, 6),
+        "1\tval\t1.0\n1\tval\t1.2\n1\tval\t2\n1\tval\tabc\n"
+        "1\terr\terr1\n1\tval\t3\n");
+      assert_eq(get_lines(s, 2, 7),
+        "2\tval\t1.0\n2\tval\t1.05\n2\tval\t1.2\n2\tval\t2\n2\tval\tabc\n"
+        "2\terr\terr1\n2\tval\t3\n");
+      assert_eq(get_lines(s, 3, 3),
+        "3\tval\t10\n3\tval\t16\n3\tval\t30\n");
+      assert_eq(s.wait(1, 0.05), "");
+
+      // new subscriber of a running poll gets its last value
+      auto d = s.add(3, "dev", "v", 0.01, 1);
+      assert_eq(get_lines(s, 3, 1), "4\tval\t3\n");
+
+      assert_err(s.remove(1, b), "unknown subscription: 2");
+      s.remove(2, b);
+      assert_err(s.remove(2, b), "unknown subscription: 2");
+      assert_eq(s.list().substr(0, 12), "dev\tv\t0.01\t2");
+
+      // the last subscription of the connection: updates are
+      // returned, then the connection is forgotten
+      assert_eq(s.wait(2, 0), "");
+      assert_err(s.wait(2, 0), "no subscriptions");
+
+      s.remove_conn(1);
+      s.remove(3, d);
+      usleep(50000); // let the poll finish
+      s.remove_conn(3);
+      assert_eq(s.list(), "");
+      assert_err(s.wait(3, 0), "no subscriptions");
+    }
+    // device is released once, by the last poll
+    assert_eq(nrel.load(), 1);
+  }
+  catch (Err e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
@@ -10,6 +10,9 @@ while read x; do
   if [ "$x" = "wait"  ];
     then sleep 10;
   fi
+  if [ "$x" = "exit"  ];
+    then exit 1;
+  fi
   if [ "$x" = error ]; then
     stdbuf -o L echo "#Error: some error";
   else
@@ -0,0 +1,468 @@
+#include <cstring>
+#include <chrono>
+#include <deque>
+#include <algorithm>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "err/err.h"
+#include "opt/opt.h"
+#include "vxi_client.h"
+
+// RPC programs and procedures
+#define PMAP_PROG   100000
+#define PMAP_VERS   2
+#define PMAP_GETPORT 3
+
+#define CORE_PROG   0x0607AF
+#define ABORT_PROG  0x0607B0
+#define VXI_VERS    1
+
+#define CREATE_LINK   10
+#define DEVICE_WRITE  11
+#define DEVICE_READ   12
+#define DEVICE_CLEAR  15
+#define DESTROY_LINK  23
+#define DEVICE_ABORT  1
+
+// device_write/device_read flags and read reasons
+#define FLAG_END      8
+#define FLAG_TERMCHR  128
+#define REASON_CHR    2
+#define REASON_END    4
+
+// Max RPC record size
+#define VXI_MAX_RECORD (64*1024*1024)
+
+typedef std::chrono::steady_clock steady;
+
+/*************************************************/
+namespace {
+
+void
+put_u32(std::string & s, uint32_t v){
+  char b[4] = {char(v>>24), char(v>>16), char(v>>8), char(v)};
+  s.append(b, 4);
+}
+
+uint32_t
+get_u32(const char * p){
+  auto u = (const unsigned char *)p;
+  return (uint32_t(u[0])<<24) | (uint32_t(u[1])<<16) |
+         (uint32_t(u[2])<<8)  |  uint32_t(u[3]);
+}
+
+// XDR decoding of RPC results
+struct XdrIn {
+  const std::string & s;
+  size_t p;
+  XdrIn(const std::string & s): s(s), p(0) {}
+  XdrIn(std::string && s) = delete;
+  uint32_t u32(){
+    if (p+4 > s.size()) throw Err() << "short RPC reply";
+    p += 4;
+    return get_u32(s.data()+p-4);
+  }
+  std::string opaque(){
+    auto n = u32();
+    if (n > s.size()-p) throw Err() << "short RPC reply";
+    std::string ret = s.substr(p, n);
+    p += (n+3) & ~3u;
+    return ret;
+  }
+};
+
+// VXI-11 error codes
+std::string
+vxi_err(const uint32_t e){
+  switch (e){
+    case 1:  return "syntax error";
+    case 3:  return "device not accessible";
+    case 4:  return "invalid link identifier";
+    case 5:  return "parameter error";
+    case 6:  return "channel not established";
+    case 8:  return "operation not supported";
+    case 9:  return "out of resources";
+    case 11: return "device locked by another link";
+    case 12: return "no lock held by this link";
+    case 15: return "I/O timeout";
+    case 17: return "I/O error";
+    case 21: return "invalid address";
+    case 23: return "operation aborted";
+    case 29: return "channel already established";
+  }
+  return "error " + type_to_str(e);
+}
+
+// Connect to a TCP port with timeout.
+int
+tcp_connect(const std::string & host, const int port, const double timeout){
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  auto port_s = type_to_str(port);
+  int e = getaddrinfo(host.c_str(), port_s.c_str(), &hints, &res);
+  if (e) throw Err() << "can't get address of " << host << ": " << gai_strerror(e);
+
+  int fd = -1, err = 0;
+  for (auto p = res; p!=NULL; p = p->ai_next){
+    fd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                p->ai_protocol);
+    if (fd<0) {err = errno; continue;}
+    if (connect(fd, p->ai_addr, p->ai_addrlen) == 0) break;
+    if (errno == EINPROGRESS){
+      struct pollfd pf = {fd, POLLOUT, 0};
+      int r = poll(&pf, 1, timeout>0 ? int(timeout*1000)+1 : -1);
+      socklen_t len = sizeof(err);
+      if (r == 1 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0
+          && err == 0) break;
+      if (r == 0) err = ETIMEDOUT;
+    }
+    else err = errno;
+    ::close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if (fd<0) throw Err(VXI_CONN_ERR) << "can't connect to " << host << ":" << port
+                        << ": " << strerror(err);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+// Read exactly n bytes before t_end (if lim is set).
+// If nothing is read and started is false throw Err(VXI_TIMEOUT).
+void
+read_n(int fd, char * buf, size_t n, const steady::time_point & t_end,
+       const bool lim, bool & started){
+  size_t p = 0;
+  while (p<n){
+    if (lim){
+      auto dt = std::chrono::duration<double>(t_end - steady::now()).count();
+      struct pollfd pf = {fd, POLLIN, 0};
+      int r = dt>0 ? poll(&pf, 1, int(dt*1000)+1) : 0;
+      if (r<0 && errno==EINTR) continue;
+      if (r<0) throw Err(VXI_CONN_ERR) << "poll error: " << strerror(errno);
+      if (r==0){
+        if (!started) throw Err(VXI_TIMEOUT) << "timeout";
+        throw Err(VXI_CONN_ERR) << "timeout in the middle of RPC reply";
+      }
+    }
+    auto res = ::recv(fd, buf+p, n-p, 0);
+    if (res<0 && errno==EINTR) continue;
+    if (res<0) throw Err(VXI_CONN_ERR) << "read error: " << strerror(errno);
+    if (res==0) throw Err(VXI_CONN_ERR) << "connection closed by the device";
+    p += res;
+    started = true;
+  }
+}
+
+}
+
+/*************************************************/
+
+VXIClient::VXIClient(const std::string & host, const std::string & dev,
+                     const int port, const double rpc_timeout):
+    host(host), dev(dev), port(port), rpc_timeout(rpc_timeout),
+    core_fd(-1), abort_fd(-1), xid(0), lid(0),
+    max_recv_size(0), abort_port(0),
+    io_timeout(2000), lock_timeout(10000) {
+  open();
+}
+
+VXIClient::~VXIClient(){
+  if (core_fd>=0){
+    try {
+      std::string a;
+      put_u32(a, lid);
+      auto x = send_call(core_fd, CORE_PROG, VXI_VERS, DESTROY_LINK, a);
+      recv_reply(core_fd, x, rpc_timeout);
+    }
+    catch (Err & e) {}
+  }
+  close();
+}
+
+void
+VXIClient::open(){
+  // get core channel port from the portmapper
+  int p = port;
+  if (p==0){
+    int fd = tcp_connect(host, 111, rpc_timeout);
+    try {
+      std::string a;
+      put_u32(a, CORE_PROG);
+      put_u32(a, VXI_VERS);
+      put_u32(a, IPPROTO_TCP);
+      put_u32(a, 0);
+      auto x = send_call(fd, PMAP_PROG, PMAP_VERS, PMAP_GETPORT, a);
+      auto res = recv_reply(fd, x, rpc_timeout);
+      XdrIn r(res);
+      p = r.u32();
+    }
+    catch (Err & e){
+      ::close(fd);
+      throw Err() << "portmapper: " << e.str();
+    }
+    ::close(fd);
+    if (p==0) throw Err() << "portmapper: VXI-11 core channel is not registered";
+  }
+
+  core_fd = tcp_connect(host, p, rpc_timeout);
+  try {
+    // create_link: clientId, lockDevice, lock_timeout, device name
+    std::string a;
+    put_u32(a, getpid());
+    put_u32(a, 0);
+    put_u32(a, lock_timeout);
+    auto x = send_call(core_fd, CORE_PROG, VXI_VERS, CREATE_LINK, a,
+                       dev.data(), dev.size());
+    auto res = recv_reply(core_fd, x, rpc_timeout + lock_timeout/1000.0);
+    XdrIn r(res);
+    auto e = r.u32();
+    if (e) throw Err() << "create_link: " << vxi_err(e);
+    lid = r.u32();
+    abort_port = r.u32();
+    max_recv_size = r.u32();
+    // minimum value according to the specification
+    if (max_recv_size < 1024) max_recv_size = 1024;
+  }
+  catch (Err & e){
+    close();
+    throw;
+  }
+}
+
+void
+VXIClient::close(){
+  if (core_fd>=0) ::close(core_fd);
+  if (abort_fd>=0) ::close(abort_fd);
+  core_fd = abort_fd = -1;
+}
+
+uint32_t
+VXIClient::send_call(int fd, uint32_t prog, uint32_t vers, uint32_t proc,
+                     const std::string & args,
+                     const char * d1, size_t n1, const char * d2, size_t n2){
+  bool data = d1 || d2;
+  size_t n = n1 + n2;
+  size_t pad = data ? (4 - n%4)%4 : 0;
+  size_t len = 40 + args.size() + (data ? 4+n+pad : 0);
+  if (len > VXI_MAX_RECORD) throw Err() << "too long RPC call";
+
+  // record mark, call header with AUTH_NONE credentials and verifier
+  std::string h;
+  put_u32(h, 0x80000000 | len);
+  put_u32(h, ++xid);
+  put_u32(h, 0); // CALL
+  put_u32(h, 2); // RPC version
+  put_u32(h, prog);
+  put_u32(h, vers);
+  put_u32(h, proc);
+  put_u32(h, 0); put_u32(h, 0);
+  put_u32(h, 0); put_u32(h, 0);
+  h += args;
+  if (data) put_u32(h, n);
+
+  // send header, data and padding without copying the data;
+  // fail if the device does not accept data for rpc_timeout
+  static const char zeros[4] = {0,0,0,0};
+  struct iovec iov[4] = {
+    {(void*)h.data(), h.size()}, {(void*)d1, n1},
+    {(void*)d2, n2}, {(void*)zeros, pad}};
+  struct iovec * v = iov;
+  int nv = 4;
+  while (nv>0){
+    if (v->iov_len == 0) {v++; nv--; continue;}
+    struct pollfd pf = {fd, POLLOUT, 0};
+    int r = poll(&pf, 1, rpc_timeout>0 ? int(rpc_timeout*1000)+1 : -1);
+    if (r<0 && errno==EINTR) continue;
+    if (r<=0){
+      // the record may be sent partially, the connection can not be used
+      auto e = r<0 ? strerror(errno) : "timeout";
+      if (fd==core_fd) close();
+      throw Err(VXI_CONN_ERR) << "write error: " << e;
+    }
+    struct msghdr m;
+    memset(&m, 0, sizeof(m));
+    m.msg_iov = v;
+    m.msg_iovlen = nv;
+    auto res = sendmsg(fd, &m, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (res<0 && (errno==EINTR || errno==EAGAIN)) continue;
+    if (res<0){
+      auto e = errno;
+      if (fd==core_fd) close();
+      throw Err(VXI_CONN_ERR) << "write error: " << strerror(e);
+    }
+    while (res>0){
+      size_t k = std::min((size_t)res, v->iov_len);
+      v->iov_base = (char*)v->iov_base + k;
+      v->iov_len -= k;
+      res -= k;
+      if (v->iov_len == 0) {v++; nv--;}
+    }
+  }
+  return xid;
+}
+
+std::string
+VXIClient::recv_reply(int fd, uint32_t x, double wait){
+  auto t_end = steady::now() +
+    std::chrono::duration_cast<steady::duration>(std::chrono::duration<double>(wait));
+  while (1){
+    // read all fragments of a record
+    std::string rec;
+    bool last = false, started = false;
+    while (!last){
+      char b[4];
+      read_n(fd, b, 4, t_end, wait>0, started);
+      auto u = get_u32(b);
+      last = u & 0x80000000;
+      size_t n = u & 0x7FFFFFFF;
+      if (rec.size() + n > VXI_MAX_RECORD) throw Err() << "too long RPC reply";
+      auto s = rec.size();
+      rec.resize(s+n);
+      if (n) read_n(fd, &rec[s], n, t_end, wait>0, started);
+    }
+
+    XdrIn r(rec);
+    if (r.u32() != x) continue; // reply to an aborted request
+    if (r.u32() != 1) throw Err() << "RPC: reply expected";
+    if (r.u32() != 0) throw Err() << "RPC: call rejected";
+    r.u32(); r.opaque(); // verifier
+    auto st = r.u32();
+    if (st) throw Err() << "RPC: call failed, accept_stat=" << st;
+    return rec.substr(r.p);
+  }
+}
+
+std::string
+VXIClient::core_reply(uint32_t x, double wait){
+  try {
+    return recv_reply(core_fd, x, wait);
+  }
+  catch (Err & e){
+    if (e.code() != VXI_TIMEOUT){ close(); throw; }
+  }
+  // No reply in time: abort the request and wait for its reply
+  // (usually with "operation aborted" error). If it does not come
+  // close the connection, it will be reopened for the next request.
+  try {
+    abort();
+    return recv_reply(core_fd, x, rpc_timeout);
+  }
+  catch (Err & e){
+    close();
+    throw Err(VXI_CONN_ERR) << "timeout, connection is closed";
+  }
+}
+
+void
+VXIClient::abort(){
+  if (core_fd<0) return;
+  try {
+    if (abort_fd<0) abort_fd = tcp_connect(host, abort_port, rpc_timeout);
+    std::string a;
+    put_u32(a, lid);
+    auto x = send_call(abort_fd, ABORT_PROG, VXI_VERS, DEVICE_ABORT, a);
+    auto res = recv_reply(abort_fd, x, rpc_timeout);
+    XdrIn r(res);
+    auto e = r.u32();
+    if (e) throw Err() << "device_abort: " << vxi_err(e);
+  }
+  catch (Err & e){
+    if (abort_fd>=0) ::close(abort_fd);
+    abort_fd = -1;
+    throw;
+  }
+}
+
+void
+VXIClient::clear(double wait){
+  if (core_fd<0) open();
+  // Device_GenericParms: lid, flags, lock_timeout, io_timeout
+  std::string a;
+  put_u32(a, lid);
+  put_u32(a, 0);
+  put_u32(a, lock_timeout);
+  put_u32(a, io_timeout);
+  auto x = send_call(core_fd, CORE_PROG, VXI_VERS, DEVICE_CLEAR, a);
+  auto res = core_reply(x, wait);
+  XdrIn r(res);
+  auto e = r.u32();
+  if (e) throw Err() << "device_clear: " << vxi_err(e);
+}
+
+void
+VXIClient::write(const std::string & msg, const std::string & tail, double wait){
+  if (core_fd<0) open();
+  size_t total = msg.size() + tail.size(), pos = 0;
+  std::deque<std::pair<uint32_t, size_t> > pending; // xid, size
+  bool last_sent = false;
+  std::string err;
+  while (!last_sent || pending.size()){
+    // send chunks, keep up to VXI_WRITE_WINDOW calls in flight
+    while (!last_sent && pending.size() < VXI_WRITE_WINDOW){
+      size_t n = std::min((size_t)max_recv_size, total-pos);
+      last_sent = (pos+n == total);
+      // Device_WriteParms: lid, io_timeout, lock_timeout, flags, data
+      std::string a;
+      put_u32(a, lid);
+      put_u32(a, io_timeout);
+      put_u32(a, lock_timeout);
+      put_u32(a, last_sent ? FLAG_END : 0);
+      size_t n1 = pos < msg.size() ? std::min(n, msg.size()-pos) : 0;
+      size_t n2 = n - n1;
+      const char * d1 = n1 ? msg.data()+pos : "";
+      const char * d2 = n2 ? tail.data() + (pos+n1-msg.size()) : NULL;
+      auto x = send_call(core_fd, CORE_PROG, VXI_VERS, DEVICE_WRITE, a,
+                         d1, n1, d2, n2);
+      pending.push_back(std::make_pair(x, n));
+      pos += n;
+    }
+    auto res = core_reply(pending.front().first, wait);
+    XdrIn r(res);
+    auto e = r.u32();
+    auto size = r.u32();
+    if (err=="" && e) err = "device_write: " + vxi_err(e);
+    if (err=="" && size != pending.front().second)
+      err = "device_write: " + type_to_str(size) + " of " +
+             type_to_str(pending.front().second) + " bytes written";
+    pending.pop_front();
+  }
+  if (err!="") throw Err() << err;
+}
+
+std::string
+VXIClient::read(const size_t req_size, const int termchar, double wait){
+  if (core_fd<0) open();
+  std::string ret;
+  while (1){
+    // Device_ReadParms: lid, requestSize, io_timeout, lock_timeout,
+    // flags, termChar
+    std::string a;
+    put_u32(a, lid);
+    put_u32(a, req_size);
+    put_u32(a, io_timeout);
+    put_u32(a, lock_timeout);
+    put_u32(a, termchar>=0 ? FLAG_TERMCHR : 0);
+    put_u32(a, termchar>=0 ? termchar : 0);
+    auto x = send_call(core_fd, CORE_PROG, VXI_VERS, DEVICE_READ, a);
+    auto rec = core_reply(x, wait);
+    XdrIn r(rec);
+    auto e = r.u32();
+    auto reason = r.u32();
+    if (e) throw Err() << "device_read: " << vxi_err(e);
+    ret += r.opaque();
+    if (reason & (REASON_END | REASON_CHR)) return ret;
+  }
+}
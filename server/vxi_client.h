@@ -0,0 +1,89 @@
+#ifndef VXI_CLIENT_H
+#define VXI_CLIENT_H
+
+#include <string>
+#include <cstdint>
+
+/*************************************************/
+// VXI-11 client (core and abort channels).
+//
+// ONC RPC over TCP is implemented here directly instead of using
+// rpcgen/libtirpc stubs:
+// - data is passed with explicit lengths (binary-safe);
+// - device_write calls are pipelined: up to VXI_WRITE_WINDOW chunks of
+//   maxRecvSize bytes are sent before waiting for replies;
+// - device_read requests are made with a large requestSize,
+//   termination character is supported;
+// - if a reply does not come in time, device_abort is sent on
+//   the abort channel, and the connection is reopened if it does not help.
+
+// Max number of device_write calls sent without waiting for replies
+#define VXI_WRITE_WINDOW 8
+
+// Error codes (Err::code()): connection errors and timeouts,
+// no reply in time (nothing is received)
+#define VXI_CONN_ERR 1
+#define VXI_TIMEOUT  2
+
+class VXIClient {
+  std::string host, dev;
+  int port;            // core channel port, 0: ask portmapper
+  double rpc_timeout;  // s
+  int core_fd, abort_fd;
+  uint32_t xid;
+  uint32_t lid;           // link ID
+  uint32_t max_recv_size; // max size of device_write data
+  uint16_t abort_port;
+
+  // open/close the core channel and the link
+  void open();
+  void close();
+
+  // Send an RPC call, return its xid. Data (d1 and d2 concatenated)
+  // is appended to args as a variable-length opaque.
+  uint32_t send_call(int fd, uint32_t prog, uint32_t vers, uint32_t proc,
+                     const std::string & args,
+                     const char * d1 = NULL, size_t n1 = 0,
+                     const char * d2 = NULL, size_t n2 = 0);
+
+  // Receive reply for xid (other replies are skipped), return results.
+  // Throw Err if there is no reply for wait seconds (wait<=0: no limit).
+  std::string recv_reply(int fd, uint32_t xid, double wait);
+
+  // Receive reply on the core channel; abort the request if it
+  // does not come in time.
+  std::string core_reply(uint32_t xid, double wait);
+
+  // Core channel call with Device_Error result.
+  void generic_call(uint32_t proc, const std::string & args, double wait);
+
+  VXIClient(const VXIClient &) = delete;
+  VXIClient& operator=(const VXIClient &) = delete;
+
+public:
+  uint32_t io_timeout;   // ms, passed to the device
+  uint32_t lock_timeout; // ms
+
+  // Connect to the device. If port is 0, get it from the portmapper.
+  VXIClient(const std::string & host, const std::string & dev,
+            const int port = 0, const double rpc_timeout = 2.0);
+  ~VXIClient();
+
+  // Send device_abort on the abort channel.
+  void abort();
+
+  // device_clear
+  void clear(double wait = 0);
+
+  // Write msg+tail (without copying), split into maxRecvSize chunks,
+  // END flag is set on the last one.
+  void write(const std::string & msg, const std::string & tail = "",
+             double wait = 0);
+
+  // Read data until END indicator (or the termination character
+  // if termchar>=0). Each device_read requests up to req_size bytes.
+  std::string read(const size_t req_size, const int termchar = -1,
+                   double wait = 0);
+};
+
+#endif
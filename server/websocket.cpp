@@ -0,0 +1,152 @@
+#include "websocket.h"
+#include "err/err.h"
+
+#include <cstring>
+#include <unistd.h>
+#include <errno.h>
+
+/*************************************************/
+
+std::string
+sha1(const std::string & data){
+  uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+  // padding: 0x80, zeros, 64-bit message length in bits
+  std::string m(data);
+  m += '\x80';
+  while (m.size()%64 != 56) m += '\0';
+  uint64_t bits = (uint64_t)data.size()*8;
+  for (int i=7; i>=0; i--) m += (char)((bits>>(8*i)) & 0xff);
+
+  auto rol = [](uint32_t x, int n){ return (x<<n) | (x>>(32-n)); };
+  for (size_t b=0; b<m.size(); b+=64){
+    uint32_t w[80];
+    for (int i=0; i<16; i++)
+      w[i] = ((uint8_t)m[b+4*i]<<24) | ((uint8_t)m[b+4*i+1]<<16) |
+             ((uint8_t)m[b+4*i+2]<<8) | (uint8_t)m[b+4*i+3];
+    for (int i=16; i<80; i++)
+      w[i] = rol(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+    uint32_t a=h[0], bb=h[1], c=h[2], d=h[3], e=h[4];
+    for (int i=0; i<80; i++){
+      uint32_t f, k;
+      if      (i<20) {f = (bb & c) | (~bb & d);          k = 0x5A827999;}
+      else if (i<40) {f = bb ^ c ^ d;                    k = 0x6ED9EBA1;}
+      else if (i<60) {f = (bb & c) | (bb & d) | (c & d); k = 0x8F1BBCDC;}
+      else           {f = bb ^ c ^ d;                    k = 0xCA62C1D6;}
+      uint32_t t = rol(a,5) + f + e + k + w[i];
+      e = d; d = c; c = rol(bb,30); bb = a; a = t;
+    }
+    h[0]+=a; h[1]+=bb; h[2]+=c; h[3]+=d; h[4]+=e;
+  }
+
+  std::string ret;
+  for (int i=0; i<5; i++)
+    for (int j=3; j>=0; j--) ret += (char)((h[i]>>(8*j)) & 0xff);
+  return ret;
+}
+
+std::string
+base64_encode(const std::string & data){
+  static const char *tab =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string ret;
+  size_t i = 0;
+  for (; i+2<data.size(); i+=3){
+    uint32_t v = ((uint8_t)data[i]<<16) | ((uint8_t)data[i+1]<<8) | (uint8_t)data[i+2];
+    ret += tab[(v>>18)&63]; ret += tab[(v>>12)&63];
+    ret += tab[(v>>6)&63];  ret += tab[v&63];
+  }
+  if (i+1 == data.size()){
+    uint32_t v = (uint8_t)data[i]<<16;
+    ret += tab[(v>>18)&63]; ret += tab[(v>>12)&63]; ret += "==";
+  }
+  else if (i+2 == data.size()){
+    uint32_t v = ((uint8_t)data[i]<<16) | ((uint8_t)data[i+1]<<8);
+    ret += tab[(v>>18)&63]; ret += tab[(v>>12)&63];
+    ret += tab[(v>>6)&63];  ret += '=';
+  }
+  return ret;
+}
+
+std::string
+ws_accept(const std::string & key){
+  return base64_encode(sha1(key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+}
+
+/*************************************************/
+
+std::string
+ws_frame(const int opcode, const std::string & data,
+         const uint32_t mask, const bool fin){
+  std::string ret;
+  ret += (char)((fin? 0x80:0) | (opcode & 0x0f));
+  uint8_t m = mask? 0x80:0;
+  uint64_t len = data.size();
+  if (len < 126) ret += (char)(m | len);
+  else if (len < 65536) {
+    ret += (char)(m | 126);
+    for (int i=1; i>=0; i--) ret += (char)((len>>(8*i)) & 0xff);
+  }
+  else {
+    ret += (char)(m | 127);
+    for (int i=7; i>=0; i--) ret += (char)((len>>(8*i)) & 0xff);
+  }
+  if (!mask) return ret + data;
+
+  char k[4];
+  for (int i=0; i<4; i++) ret += k[i] = (char)((mask>>(8*(3-i))) & 0xff);
+  size_t n = ret.size();
+  ret += data;
+  for (size_t i=0; i<data.size(); i++) ret[n+i] ^= k[i%4];
+  return ret;
+}
+
+// read data to buf until it has at least n bytes (extra data
+// is kept in buf for the next frame)
+static bool
+ws_fill(int fd, std::string & buf, const size_t n){
+  char tmp[65536];
+  while (buf.size() < n){
+    auto ret = ::read(fd, tmp, sizeof(tmp));
+    if (ret<0 && errno == EINTR) continue;
+    if (ret<0) throw Err() << "websocket: read error: " << strerror(errno);
+    if (ret==0) return false;
+    buf.append(tmp, ret);
+  }
+  return true;
+}
+
+bool
+ws_read_frame(int fd, std::string & buf, WsFrame & frame,
+              const size_t max_size){
+  if (!ws_fill(fd, buf, 2)){
+    if (buf.size()==0) return false;
+    throw Err() << "websocket: unexpected end of file";
+  }
+  frame.fin    = (uint8_t)buf[0] & 0x80;
+  frame.opcode = (uint8_t)buf[0] & 0x0f;
+  bool masked  = (uint8_t)buf[1] & 0x80;
+  uint64_t len = (uint8_t)buf[1] & 0x7f;
+
+  size_t hsize = 2 + (len==126? 2: len==127? 8: 0) + (masked? 4:0);
+  if (!ws_fill(fd, buf, hsize))
+    throw Err() << "websocket: unexpected end of file";
+  size_t p = 2;
+  if (len >= 126){
+    int n = len==126? 2:8;
+    len = 0;
+    for (int i=0; i<n; i++) len = (len<<8) | (uint8_t)buf[p++];
+  }
+  if (len > max_size) throw Err() << "websocket: too long frame: " << len;
+  char k[4] = {0,0,0,0};
+  if (masked) for (int i=0; i<4; i++) k[i] = buf[p++];
+
+  if (!ws_fill(fd, buf, hsize + len))
+    throw Err() << "websocket: unexpected end of file";
+  frame.data = buf.substr(hsize, len);
+  buf.erase(0, hsize + len);
+  if (masked)
+    for (size_t i=0; i<frame.data.size(); i++) frame.data[i] ^= k[i%4];
+  return true;
+}
@@ -0,0 +1,44 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <string>
+#include <cstdint>
+
+/*************************************************/
+// WebSocket (RFC 6455) handshake and framing, used by HTTP_Server
+// for connections upgraded to WebSocket (see BinSession).
+
+// Frame opcodes
+#define WS_CONT   0
+#define WS_TEXT   1
+#define WS_BIN    2
+#define WS_CLOSE  8
+#define WS_PING   9
+#define WS_PONG  10
+
+// Value of Sec-WebSocket-Accept header for a Sec-WebSocket-Key.
+std::string ws_accept(const std::string & key);
+
+// SHA-1 digest (20 bytes) and base64 encoding (for the handshake).
+std::string sha1(const std::string & data);
+std::string base64_encode(const std::string & data);
+
+// Pack a frame. Server frames are not masked, clients should
+// use a non-zero mask.
+std::string ws_frame(const int opcode, const std::string & data,
+                     const uint32_t mask = 0, const bool fin = true);
+
+struct WsFrame {
+  int opcode;
+  bool fin;
+  std::string data; // unmasked payload
+};
+
+// Read one frame from a socket. Data which was already received
+// (e.g. together with the HTTP request) is taken from buf first.
+// Return false on end of file before the frame starts,
+// throw Err on errors and frames longer than max_size.
+bool ws_read_frame(int fd, std::string & buf, WsFrame & frame,
+                   const size_t max_size);
+
+#endif
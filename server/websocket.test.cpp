@@ -0,0 +1,228 @@
+///\cond HIDDEN (do not show this in Doxyden)
+
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include "websocket.h"
+#include "bin_server.h"
+#include "bin_client.h"
+#include "err/assert_err.h"
+
+using namespace std;
+
+string
+hex(const string & s){
+  string ret;
+  char b[3];
+  for (auto c: s) {snprintf(b, sizeof(b), "%02x", (uint8_t)c); ret += b;}
+  return ret;
+}
+
+// number of open file descriptors
+int
+count_fds(){
+  int n = 0;
+  DIR *d = opendir("/proc/self/fd");
+  while (readdir(d)) n++;
+  closedir(d);
+  return n;
+}
+
+// send a request from a client, return the response
+BinResponse
+ws_call(int fd, string & buf, const BinRequest & req){
+  bin_write(fd, ws_frame(WS_BIN, bin_pack(req).substr(4), 0x12345678));
+  WsFrame f;
+  if (!ws_read_frame(fd, buf, f, BIN_MAX_FRAME)) throw Err() << "no response";
+  assert_eq(f.opcode, WS_BIN);
+  return bin_unpack_response(f.data);
+}
+
+int
+main(){
+  try{
+
+    // handshake
+    assert_eq(hex(sha1("")), "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+    assert_eq(hex(sha1("abc")), "a9993e364706816aba3e25717850c26c9cd0d89d");
+    assert_eq(hex(sha1(string(1000, 'a'))),
+              "291e9a6c66994949b57ba5e650361e98fc36b1ba");
+    assert_eq(base64_encode(""), "");
+    assert_eq(base64_encode("f"), "Zg==");
+    assert_eq(base64_encode("fo"), "Zm8=");
+    assert_eq(base64_encode("foo"), "Zm9v");
+    assert_eq(base64_encode("foob"), "Zm9vYg==");
+    assert_eq(ws_accept("dGhlIHNhbXBsZSBub25jZQ=="), "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+
+    // frames
+    assert_eq(hex(ws_frame(WS_TEXT, "Hello")), "810548656c6c6f");
+    assert_eq(hex(ws_frame(WS_TEXT, "Hello", 0x37fa213d)),
+              "818537fa213d7f9f4d5158");
+    assert_eq(hex(ws_frame(WS_BIN, string(256, 'x')).substr(0,4)), "827e0100");
+    assert_eq(hex(ws_frame(WS_BIN, string(65536, 'x')).substr(0,10)),
+              "827f0000000000010000");
+
+    {
+      int sv[2];
+      assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+      string buf, data;
+      for (auto n: {0, 125, 126, 1000, 70000})
+        data += ws_frame(WS_BIN, string(n, 'a'+n%26), n? n:1, n!=1000);
+      data += ws_frame(WS_BIN, string(200, 'x'));
+      thread t([&]{ bin_write(sv[0], data); shutdown(sv[0], SHUT_WR); });
+
+      WsFrame f;
+      for (auto n: {0, 125, 126, 1000, 70000}){
+        assert_eq(ws_read_frame(sv[1], buf, f, 100000), true);
+        assert_eq(f.opcode, WS_BIN);
+        assert_eq(f.fin, n!=1000);
+        assert_eq(f.data, string(n, 'a'+n%26));
+      }
+      assert_err(ws_read_frame(sv[1], buf, f, 100),
+        "websocket: too long frame: 200");
+      t.join();
+      buf.clear();
+      assert_eq(ws_read_frame(sv[1], buf, f, 100), false);
+      ::close(sv[0]);
+      ::close(sv[1]);
+    }
+
+    // requests to one device are processed in order
+    {
+      DevManager dm("test_data/n7.txt");
+      int sv[2];
+      assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+      BinSession s(sv[1], &dm, 8);
+      s.start();
+      BinRequest r;
+      r.act = "ask";
+      r.arg = "b";
+      string data;
+      for (int i=1; i<=200; i++){
+        r.id = i;
+        r.msg = type_to_str(i);
+        data += bin_pack(r);
+      }
+      bin_write(sv[0], data);
+      string body, ids, ans;
+      for (int i=1; i<=200; i++){
+        assert_eq(bin_read_frame(sv[0], body), true);
+        auto resp = bin_unpack_response(body);
+        ids += type_to_str(resp.id) + " ";
+        ans += resp.data + " ";
+      }
+      shutdown(sv[0], SHUT_RDWR);
+      for (int i=0; i<100 && !s.finished(); i++) usleep(10000);
+      assert_eq(s.finished(), true);
+      ::close(sv[0]);
+      ::close(sv[1]);
+      string ids0, ans0;
+      for (int i=1; i<=200; i++){
+        ids0 += type_to_str(i) + " ";
+        ans0 += "Q: " + type_to_str(i) + " ";
+      }
+      assert_eq(ids, ids0);
+      assert_eq(ans, ans0);
+    }
+
+    // binary server: a session is closed as soon as
+    // the client disconnects
+    {
+      DevManager dm("test_data/n7.txt");
+      string path = "/tmp/device2_bin_test.sock";
+      auto srv = BinServer::unix_socket(path, 0, &dm, false);
+      int n0 = count_fds();
+      {
+        BinClient c(path);
+        assert_eq(c.get("ask", "a", "x"), "x");
+        assert_eq(count_fds() > n0, true);
+      }
+      for (int i=0; i<100 && count_fds() > n0; i++) usleep(10000);
+      assert_eq(count_fds(), n0);
+    }
+
+    // binary protocol session over WebSocket
+    {
+      DevManager dm("test_data/n7.txt");
+      int sv[2];
+      assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+      // first request is received together with the handshake
+      BinRequest r;
+      r.id = 1;
+      r.act = "ask";
+      r.arg = "a";
+      r.msg = "hello";
+      BinSession s(sv[1], &dm, 4, true,
+                   ws_frame(WS_BIN, bin_pack(r).substr(4), 1));
+      std::atomic<bool> fin(false);
+      s.on_finish([&fin]{ fin = true; });
+      s.start();
+
+      string buf;
+      WsFrame f;
+      assert_eq(ws_read_frame(sv[0], buf, f, BIN_MAX_FRAME), true);
+      auto resp = bin_unpack_response(f.data);
+      assert_eq(resp.id, 1);
+      assert_eq(resp.data, "hello");
+
+      r.id = 2;
+      r.arg = "x";
+      resp = ws_call(sv[0], buf, r);
+      assert_eq(resp.id, 2);
+      assert_eq(resp.err, true);
+      assert_eq(resp.data, "unknown device: x");
+
+      // ping
+      bin_write(sv[0], ws_frame(WS_PING, "abc", 1));
+      assert_eq(ws_read_frame(sv[0], buf, f, BIN_MAX_FRAME), true);
+      assert_eq(f.opcode, WS_PONG);
+      assert_eq(f.data, "abc");
+
+      // fragmented message
+      r.id = 3;
+      r.arg = "a";
+      auto body = bin_pack(r).substr(4);
+      bin_write(sv[0], ws_frame(WS_BIN, body.substr(0,5), 1, false));
+      bin_write(sv[0], ws_frame(WS_CONT, body.substr(5), 1, true));
+      assert_eq(ws_read_frame(sv[0], buf, f, BIN_MAX_FRAME), true);
+      assert_eq(bin_unpack_response(f.data).id, 3);
+
+      // subscription updates are pushed
+      r.id = 4;
+      r.act = "subscribe";
+      r.msg = "val";
+      r.opts.put("period", 0.01);
+      // (the update can arrive before the response)
+      resp = ws_call(sv[0], buf, r);
+      assert_eq(ws_read_frame(sv[0], buf, f, BIN_MAX_FRAME), true);
+      auto resp1 = bin_unpack_response(f.data);
+      if (resp.id == BIN_PUSH_ID) swap(resp, resp1);
+      assert_eq(resp.id, 4);
+      assert_eq(resp.data, "1");
+      resp = resp1;
+      assert_eq(resp.id, BIN_PUSH_ID);
+      assert_eq(resp.data.substr(0, 10), "updates\n1\t");
+      assert_eq(resp.data.substr(resp.data.size()-9), "\tval\tval\n");
+
+      // close
+      bin_write(sv[0], ws_frame(WS_CLOSE, "\x03\xe8", 1));
+      assert_eq(ws_read_frame(sv[0], buf, f, BIN_MAX_FRAME), true);
+      assert_eq(f.opcode, WS_CLOSE);
+      assert_eq(hex(f.data), "03e8");
+      for (int i=0; i<100 && !fin; i++) usleep(10000);
+      assert_eq(fin.load(), true);
+      assert_eq(s.finished(), true);
+      ::close(sv[0]);
+      ::close(sv[1]);
+    }
+
+  }
+  catch (Err e) {
+    std::cerr << "Error: " << e.str() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+///\endcond
@@ -17,6 +17,20 @@ namespace eval Device2 {
   # Server address. Updated from /etc/device_c.cfg
   set addr [exec device_c get_srv]
 
+  # Unix domain socket ("unix:<path>" address).
+  # unix_sockets package is needed for this.
+  set socket {}
+  if {[regexp {^unix:(.*)$} $addr v socket]} {
+    package require unix_sockets
+    set addr unix://localhost
+  }
+
+  # socket command for http package
+  proc unix_socket {args} {
+    return [unix_sockets::connect $Device2::socket]
+  }
+  http::register unix 80 Device2::unix_socket
+
   # nutmeat
   proc get {act dev args} {
     set act [http::quoteString $act]